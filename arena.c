@@ -0,0 +1,118 @@
+/**
+ * Region allocator for data that lives only as long as one command line.
+ *
+ * Allocation bumps a pointer through a list of chunks, and everything is
+ * released at once by arena_reset(), which keeps the chunks for reuse. The
+ * arena grows by adding chunks, so a long line costs more memory but never
+ * fails to fit.
+ */
+
+#include "arena.h"
+#include <stdlib.h>
+
+// Alignment of every allocation, enough for any standard type.
+#define ARENA_ALIGN 16
+
+/**
+ * A block of memory handed out by the arena.
+ *
+ * Fields:
+ * next : the following chunk, or NULL
+ * size : number of bytes in data
+ * used : number of bytes of data handed out since the last reset
+ * data : the memory itself
+ */
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+/**
+ * Fields:
+ * first : the first chunk, or NULL if nothing has been allocated
+ * current : the chunk allocations are made from
+ */
+struct arena {
+    struct arena_chunk *first;
+    struct arena_chunk *current;
+};
+
+/**
+ * Returns size bytes of memory, aligned for any type, that remain valid
+ * until the arena is reset.
+ */
+void *arena_alloc(Arena arena, size_t size) {
+    struct arena_chunk *chunk = arena->current;
+
+    // Round up to keep the next allocation aligned.
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    // Move on to the next chunk that has room, if any.
+    while (chunk != NULL && chunk->used + size > chunk->size) {
+        if (chunk->next == NULL || chunk->next->size < size) {
+            chunk = NULL;
+            break;
+        }
+        chunk = chunk->next;
+        arena->current = chunk;
+    }
+
+    if (chunk == NULL) {
+        size_t chunk_size = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+
+        chunk = malloc(sizeof(struct arena_chunk) + chunk_size);
+        chunk->size = chunk_size;
+        chunk->used = 0;
+
+        // Insert after the current chunk, so later chunks are still reused.
+        if (arena->current == NULL) {
+            chunk->next = NULL;
+            arena->first = chunk;
+        } else {
+            chunk->next = arena->current->next;
+            arena->current->next = chunk;
+        }
+        arena->current = chunk;
+    }
+
+    void *memory = chunk->data + chunk->used;
+    chunk->used += size;
+
+    return memory;
+}
+
+/**
+ * Releases everything allocated from the arena, keeping its chunks.
+ */
+void arena_reset(Arena arena) {
+    for (struct arena_chunk *chunk = arena->first; chunk != NULL;
+         chunk = chunk->next) {
+        chunk->used = 0;
+    }
+
+    arena->current = arena->first;
+}
+
+/**
+ * Frees the arena and all of its chunks.
+ */
+void free_arena(Arena arena) {
+    struct arena_chunk *chunk = arena->first;
+
+    while (chunk != NULL) {
+        struct arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(arena);
+}
+
+/**
+ * Creates an empty arena.
+ */
+Arena new_arena(void) {
+    return calloc(1, sizeof(struct arena));
+}
@@ -0,0 +1,20 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Minimum size of each block of memory the arena takes from malloc.
+#define ARENA_CHUNK 16384
+
+// Incomplete type to encapsulate its data structure.
+// The struct is implemented in arena.c.
+struct arena;
+
+typedef struct arena *Arena;
+
+void *arena_alloc(Arena arena, size_t size);
+void arena_reset(Arena arena);
+void free_arena(Arena arena);
+Arena new_arena(void);
+
+#endif
@@ -0,0 +1,166 @@
+/**
+ * Benchmark of smallsh's command parsing throughput.
+ *
+ * Generates a reproducible corpus of command lines like those of generated
+ * batch scripts, then times tokenizing alone and full parse_command() over
+ * it with each tokenizer the CPU supports, reporting lines and bytes per
+ * second.
+ *
+ * Usage: parsebench [lines] [passes]
+ */
+
+#include "arena.h"
+#include "commands.h"
+#include "tokenize.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_LINES 200000
+#define DEFAULT_PASSES 5
+
+const char *words[] = {"ls",    "-l",       "grep",        "cat",
+                       "gzip",  "--best",   "data.txt",    "sort",
+                       "-n",    "/usr/bin", "output.log",  "wc",
+                       "-c",    "find",     "--name",      "src/main.c",
+                       "echo",  "hello",    "build/x.o",   "awk"};
+
+unsigned long rng_state = 12345;
+
+/**
+ * Linear congruential generator, so the corpus is the same on every run.
+ */
+unsigned long next_random(void) {
+    rng_state = rng_state * 6364136223846793005UL + 1442695040888963407UL;
+    return rng_state >> 33;
+}
+
+/**
+ * Builds a corpus of count newline-terminated lines, storing the offset of
+ * each line in offsets and the total size in size.
+ */
+char *make_corpus(int count, size_t *offsets, size_t *size) {
+    size_t capacity = (size_t)count * 64;
+    size_t len = 0;
+    char *corpus = malloc(capacity);
+    size_t nwords = sizeof(words) / sizeof(words[0]);
+
+    for (int i = 0; i < count; i++) {
+        int args = 1 + next_random() % 12;
+        int stages = next_random() % 4 == 0 ? 2 : 1;
+
+        if (len + 1024 > capacity) {
+            capacity *= 2;
+            corpus = realloc(corpus, capacity);
+        }
+
+        offsets[i] = len;
+        for (int stage = 0; stage < stages; stage++) {
+            if (stage > 0) {
+                len += sprintf(corpus + len, " | ");
+            }
+            for (int arg = 0; arg < args; arg++) {
+                len += sprintf(corpus + len, arg == 0 ? "%s" : " %s",
+                               words[next_random() % nwords]);
+            }
+        }
+        if (next_random() % 3 == 0) {
+            len += sprintf(corpus + len, " > out%lu.txt", next_random() % 100);
+        }
+        if (next_random() % 5 == 0) {
+            len += sprintf(corpus + len, " &");
+        }
+        corpus[len++] = '\n';
+    }
+
+    *size = len;
+    return corpus;
+}
+
+double seconds_since(struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Times passes over the corpus, either tokenizing or fully parsing each
+ * line, and prints the best pass.
+ */
+void run(const char *label, char *corpus, char *work, size_t size,
+         size_t *offsets, int count, int passes, int full_parse) {
+    Arena arena = new_arena();
+    double best = 0;
+    long tokens = 0;
+
+    for (int pass = 0; pass < passes; pass++) {
+        struct timespec start;
+
+        // Parsing modifies the line, so each pass gets a fresh copy.
+        memcpy(work, corpus, size);
+        for (int i = 0; i < count; i++) {
+            work[offsets[i + 1] - 1] = '\0';
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < count; i++) {
+            char *line = work + offsets[i];
+
+            if (full_parse) {
+                parse_command(arena, line, 0);
+            } else {
+                struct tokenizer tok;
+                enum token_kind kind;
+
+                init_tokenizer(&tok, arena, line, offsets[i + 1] - 1 - offsets[i]);
+                while (next_token(&tok, &kind) != NULL) {
+                    tokens++;
+                }
+            }
+            arena_reset(arena);
+        }
+
+        double elapsed = seconds_since(&start);
+        if (pass == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    printf("%-8s %-9s %12.0f lines/s %9.1f MB/s\n", scanner_name(), label,
+           count / best, size / best / 1e6);
+    free_arena(arena);
+}
+
+int main(int argc, char *argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : DEFAULT_LINES;
+    int passes = argc > 2 ? atoi(argv[2]) : DEFAULT_PASSES;
+    const char *names[] = {"scalar", "sse2", "avx2"};
+    size_t *offsets;
+    size_t size;
+    char *corpus, *work;
+
+    if (count <= 0 || passes <= 0) {
+        fprintf(stderr, "usage: parsebench [lines] [passes]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    offsets = malloc((count + 1) * sizeof(size_t));
+    corpus = make_corpus(count, offsets, &size);
+    offsets[count] = size;
+    work = malloc(size);
+
+    printf("%d lines, %zu bytes, best of %d passes\n", count, size, passes);
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (select_scanner(names[i]) != 0) {
+            printf("%-8s unsupported\n", names[i]);
+            continue;
+        }
+        run("tokenize", corpus, work, size, offsets, count, passes, 0);
+        run("parse", corpus, work, size, offsets, count, passes, 1);
+    }
+
+    exit(EXIT_SUCCESS);
+}
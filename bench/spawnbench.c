@@ -0,0 +1,262 @@
+/**
+ * Benchmark of the latency with which smallsh runs commands.
+ *
+ * Starts smallsh reading commands from a pipe and feeds it reproducible
+ * workloads, following each command with the status built-in, whose output
+ * marks the command as finished. Reports, for each workload, the throughput
+ * and the percentiles of the time from writing a command to reading its
+ * status.
+ *
+ * Workloads:
+ *  trivial : /bin/true, the cost of creating a process and running it
+ *  builtin : true, which runs in the shell, for comparison
+ *  argv : /bin/true with LONG_ARGS arguments
+ *  redirect : /bin/cat with its input and output redirected to files
+ *  background : bursts of /bin/true & followed by wait, timed per burst
+ *
+ * Usage: spawnbench [-n count] [-b burst] [smallsh]
+ */
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_COUNT 10000
+#define DEFAULT_BURST 100
+
+// Commands run before each workload is timed.
+#define WARMUP 100
+
+// Arguments given to each command of the argv workload.
+#define LONG_ARGS 1000
+
+// Bytes in the input file of the redirect workload.
+#define REDIRECT_SIZE 4096
+
+// A smallsh process and the pipes through which it is driven.
+struct shell {
+    pid_t pid;
+    FILE *in;
+    FILE *out;
+    char *line;
+    size_t line_size;
+};
+
+double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Starts the smallsh at path, reading commands from a pipe and writing its
+ * output to another.
+ */
+void start_shell(struct shell *sh, char *path) {
+    int to_shell[2], from_shell[2];
+
+    if (pipe(to_shell) == -1 || pipe(from_shell) == -1) {
+        perror("pipe()");
+        exit(EXIT_FAILURE);
+    }
+
+    sh->pid = fork();
+    if (sh->pid == -1) {
+        perror("fork()");
+        exit(EXIT_FAILURE);
+    }
+    if (sh->pid == 0) {
+        dup2(to_shell[0], STDIN_FILENO);
+        dup2(from_shell[1], STDOUT_FILENO);
+        close(to_shell[0]);
+        close(to_shell[1]);
+        close(from_shell[0]);
+        close(from_shell[1]);
+        execl(path, path, (char *)NULL);
+        perror(path);
+        _exit(127);
+    }
+
+    close(to_shell[0]);
+    close(from_shell[1]);
+    sh->in = fdopen(to_shell[1], "w");
+    sh->out = fdopen(from_shell[0], "r");
+    sh->line = NULL;
+    sh->line_size = 0;
+}
+
+/**
+ * Reads the shell's output up to the next line printed by status.
+ */
+void await_status(struct shell *sh) {
+    while (getline(&sh->line, &sh->line_size, sh->out) != -1) {
+        if (strncmp(sh->line, "exit value ", 11) == 0 ||
+            strncmp(sh->line, "terminated by signal ", 21) == 0) {
+            return;
+        }
+    }
+
+    fprintf(stderr, "spawnbench: smallsh exited early\n");
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Sends count copies of cmd, then status, and returns the seconds until the
+ * status is read.
+ */
+double time_commands(struct shell *sh, char *cmd, int count) {
+    double start = now();
+
+    for (int i = 0; i < count; i++) {
+        fputs(cmd, sh->in);
+    }
+    fputs("status\n", sh->in);
+    fflush(sh->in);
+    await_status(sh);
+
+    return now() - start;
+}
+
+int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Prints throughput and latency percentiles for samples, which each cover
+ * per_sample commands and are sorted in place.
+ */
+void report(char *name, double *samples, int count, int per_sample) {
+    double total = 0;
+
+    for (int i = 0; i < count; i++) {
+        total += samples[i];
+    }
+    qsort(samples, count, sizeof(double), compare_double);
+
+    printf("%-10s %8d %9.3f %10.0f %9.1f %9.1f %9.1f %9.1f\n", name,
+           count * per_sample, total, count * per_sample / total,
+           samples[count / 2] * 1e6, samples[count * 9 / 10] * 1e6,
+           samples[count * 99 / 100] * 1e6, samples[count - 1] * 1e6);
+    fflush(stdout);
+}
+
+/**
+ * Runs cmd count times, one at a time, and reports on it as name.
+ */
+void run_workload(struct shell *sh, char *name, char *cmd, int count) {
+    double *samples = malloc(count * sizeof(double));
+
+    time_commands(sh, cmd, WARMUP);
+    for (int i = 0; i < count; i++) {
+        samples[i] = time_commands(sh, cmd, 1);
+    }
+
+    report(name, samples, count, 1);
+    free(samples);
+}
+
+int main(int argc, char *argv[]) {
+    int count = DEFAULT_COUNT, burst = DEFAULT_BURST, opt;
+    char *path = "./smallsh";
+    char dir[] = "/tmp/spawnbench.XXXXXX";
+    char cmd[256], *argv_cmd, *burst_cmd;
+    struct shell sh;
+    double *samples;
+    int bursts;
+    FILE *file;
+
+    while ((opt = getopt(argc, argv, "n:b:")) != -1) {
+        switch (opt) {
+            case 'n':
+                count = atoi(optarg);
+                break;
+            case 'b':
+                burst = atoi(optarg);
+                break;
+            default:
+                count = 0;
+                break;
+        }
+    }
+    if (optind < argc) {
+        path = argv[optind];
+    }
+    if (count <= 0 || burst <= 0 || optind + 1 < argc) {
+        fprintf(stderr, "usage: spawnbench [-n count] [-b burst] [smallsh]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp()");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(cmd, sizeof(cmd), "%s/in.txt", dir);
+    file = fopen(cmd, "w");
+    for (int i = 0; i < REDIRECT_SIZE; i++) {
+        fputc(i % 64 == 63 ? '\n' : 'a' + i % 26, file);
+    }
+    fclose(file);
+
+    // The shell cannot be told apart from its output if it stops early.
+    signal(SIGPIPE, SIG_IGN);
+    start_shell(&sh, path);
+
+    printf("%s, %d commands per workload, background bursts of %d\n", path,
+           count, burst);
+    printf("%-10s %8s %9s %10s %9s %9s %9s %9s\n", "workload", "commands",
+           "total s", "cmds/s", "p50 us", "p90 us", "p99 us", "max us");
+
+    run_workload(&sh, "trivial", "/bin/true\n", count);
+    run_workload(&sh, "builtin", "true\n", count);
+
+    argv_cmd = malloc(LONG_ARGS * 8 + 16);
+    strcpy(argv_cmd, "/bin/true");
+    for (int i = 0; i < LONG_ARGS; i++) {
+        sprintf(argv_cmd + strlen(argv_cmd), " arg%d", i);
+    }
+    strcat(argv_cmd, "\n");
+    run_workload(&sh, "argv", argv_cmd, count);
+
+    snprintf(cmd, sizeof(cmd), "/bin/cat < %s/in.txt > %s/out.txt\n", dir,
+             dir);
+    run_workload(&sh, "redirect", cmd, count);
+
+    // Each burst starts its jobs, then waits for all of them.
+    burst_cmd = malloc(burst * 12 + 8);
+    burst_cmd[0] = '\0';
+    for (int i = 0; i < burst; i++) {
+        strcat(burst_cmd, "/bin/true &\n");
+    }
+    strcat(burst_cmd, "wait\n");
+    bursts = count / burst > 0 ? count / burst : 1;
+    samples = malloc(bursts * sizeof(double));
+    time_commands(&sh, burst_cmd, 1);
+    for (int i = 0; i < bursts; i++) {
+        samples[i] = time_commands(&sh, burst_cmd, 1);
+    }
+    report("background", samples, bursts, burst);
+
+    fclose(sh.in);
+    waitpid(sh.pid, NULL, 0);
+    fclose(sh.out);
+
+    snprintf(cmd, sizeof(cmd), "%s/in.txt", dir);
+    unlink(cmd);
+    snprintf(cmd, sizeof(cmd), "%s/out.txt", dir);
+    unlink(cmd);
+    rmdir(dir);
+
+    free(samples);
+    free(burst_cmd);
+    free(argv_cmd);
+    free(sh.line);
+    exit(EXIT_SUCCESS);
+}
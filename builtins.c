@@ -1,16 +1,58 @@
 #include "builtins.h"
+#include "capture.h"
+#include "history.h"
+#include "parallel.h"
+#include "pathcache.h"
+#include "placement.h"
+#include "utilities.h"
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
-// Tracks the status of the last process to terminate.
+// Tracks the status of the last process to terminate, and whether it was
+// signalled for exceeding a time limit.
 struct status {
     enum { EXIT_CODE = 0, SIGNAL = 1 } kind;
     int code;
+    bool timed_out;
 };
 
 // External variable to track status while smallsh is running.
-Status status = {0, 0};
+Status status = {0, 0, false};
+
+// Capacity in bytes requested for pipes between pipeline stages, where 0
+// leaves the kernel's default.
+int pipe_size = 0;
+
+// The built-in commands, sorted by name for find_builtin().
+struct builtin builtins[] = {
+    {"[", test_command, true},
+    {"cd", change_directory, false},
+    {"echo", echo_command, true},
+    {"exit", exit_command, false},
+    {"false", false_command, true},
+    {"hash", hash_command, false},
+    {"history", history_command, false},
+    {"jobs", jobs_command, false},
+    {"output", output_command, false},
+    {"parallel", parallel_command, false},
+    {"pipesize", pipe_size_command, false},
+    {"place", place_command, false},
+    {"printf", printf_command, true},
+    {"pwd", pwd_command, true},
+    {"sleep", sleep_command, true},
+    {"status", status_command, false},
+    {"test", test_command, true},
+    {"true", true_command, true},
+    {"wait", wait_command, false},
+};
+
+int compare_builtin(const void *name, const void *builtin);
 
 /*
  * Changes the current working directory of smallsh using the
@@ -18,14 +60,14 @@ Status status = {0, 0};
  * With no arguments, sets the pwd to the user's $HOME.
  * Takes an optional argument, which may be a relative or absolute pathname.
  */
-void change_directory(char *argv[], int argc) {
+int change_directory(char *argv[], int argc, JobTable jobs) {
     int result;
 
     // Check for correct number of arguments.
     if (argc > 2) {
         printf("smallsh: cd: too many arguments\n");
         fflush(stdout);
-        return;
+        return NO_STATUS;
     }
 
     // Check for argument.
@@ -35,13 +77,13 @@ void change_directory(char *argv[], int argc) {
         if (home_path == NULL) {
             printf("No directory path set for user's $HOME.\n");
             fflush(stdout);
-            return;
+            return NO_STATUS;
         }
         // Set global g_curr_dir variable to user's $HOME
         result = chdir(home_path);
         if (result != 0) {
             perror("chdir() to HOME");
-            return;
+            return NO_STATUS;
         }
     } else {
         // Try to change working directory to first command argument.
@@ -52,28 +94,254 @@ void change_directory(char *argv[], int argc) {
             perror("chdir()");
         }
     }
+
+    return NO_STATUS;
 }
 
 /**
- * Prints to stdout the status of the last process to terminate.
+ * Compares a command name with the name of a built-in, for bsearch().
  */
-void print_status(void) {
+int compare_builtin(const void *name, const void *builtin) {
+    return strcmp(name, ((const struct builtin *)builtin)->name);
+}
+
+/**
+ * Terminates all background jobs, then smallsh.
+ */
+int exit_command(char *argv[], int argc, JobTable jobs) {
+    kill_all(jobs);
+
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * Returns the built-in command called name, or NULL if there is none.
+ */
+struct builtin *find_builtin(char *name) {
+    return bsearch(name, builtins, sizeof(builtins) / sizeof(builtins[0]),
+                   sizeof(builtins[0]), compare_builtin);
+}
+
+/**
+ * Inspects the cache of command locations.
+ *
+ * With no arguments, lists each remembered command and its hit count. The -r
+ * option forgets all locations. Any other arguments are command names to be
+ * looked up and remembered.
+ */
+int hash_command(char *argv[], int argc, JobTable jobs) {
+    if (argc == 1) {
+        hash_print();
+        return NO_STATUS;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            hash_clear();
+        } else if (hash_lookup(argv[i]) == NULL) {
+            printf("smallsh: hash: %s: not found\n", argv[i]);
+            fflush(stdout);
+        }
+    }
+
+    return NO_STATUS;
+}
+
+/**
+ * Lists the background jobs, or with -j shows or sets the most that may run
+ * at once. Commands started with & beyond the limit wait in a queue. With
+ * -k, shows or sets how long jobs are given to exit after SIGTERM when
+ * smallsh exits, before they are killed.
+ *
+ * Usage: jobs [-j [N] | -k [DURATION]], where N of 0 means no limit.
+ */
+int jobs_command(char *argv[], int argc, JobTable jobs) {
+    double grace;
+    char *end;
+    long limit;
+
+    if (argc == 1) {
+        print_jobs(jobs);
+        return NO_STATUS;
+    }
+
+    if ((strcmp(argv[1], "-j") != 0 && strcmp(argv[1], "-k") != 0) ||
+        argc > 3) {
+        printf("smallsh: jobs: usage: jobs [-j [N] | -k [DURATION]]\n");
+        fflush(stdout);
+        return NO_STATUS;
+    }
+
+    if (strcmp(argv[1], "-k") == 0) {
+        if (argc == 2) {
+            printf("exit grace %gs\n", exit_grace(jobs));
+            fflush(stdout);
+        } else if (parse_duration(argv[2], &grace) == -1) {
+            printf("smallsh: jobs: %s: invalid duration\n", argv[2]);
+            fflush(stdout);
+        } else {
+            set_exit_grace(jobs, grace);
+        }
+        return NO_STATUS;
+    }
+
+    if (argc == 2) {
+        if (job_limit(jobs) == 0) {
+            printf("job limit none\n");
+        } else {
+            printf("job limit %d\n", job_limit(jobs));
+        }
+        fflush(stdout);
+        return NO_STATUS;
+    }
+
+    limit = strtol(argv[2], &end, 10);
+    if (*end != '\0' || argv[2][0] == '\0' || limit < 0 || limit > INT_MAX) {
+        printf("smallsh: jobs: %s: invalid limit\n", argv[2]);
+        fflush(stdout);
+        return NO_STATUS;
+    }
+
+    set_job_limit(jobs, limit);
+
+    return NO_STATUS;
+}
+
+/**
+ * Shows or sets the capacity of pipes created between pipeline stages.
+ *
+ * With no arguments, prints the current setting. Given a size in bytes, checks
+ * it against a test pipe, since the kernel rounds capacities up to a whole
+ * number of pages and limits unprivileged users to
+ * /proc/sys/fs/pipe-max-size. A size of 0 restores the kernel's default.
+ */
+int pipe_size_command(char *argv[], int argc, JobTable jobs) {
+    int test_fds[2];
+    char *end;
+    long size;
+
+    if (argc > 2) {
+        printf("smallsh: pipesize: too many arguments\n");
+        fflush(stdout);
+        return NO_STATUS;
+    }
+
+    if (argc == 1) {
+        if (pipe_size == 0) {
+            printf("pipe size default\n");
+        } else {
+            printf("pipe size %d\n", pipe_size);
+        }
+        fflush(stdout);
+        return NO_STATUS;
+    }
+
+    size = strtol(argv[1], &end, 10);
+    if (*end != '\0' || size < 0 || size > INT_MAX) {
+        printf("smallsh: pipesize: %s: invalid size\n", argv[1]);
+        fflush(stdout);
+        return NO_STATUS;
+    }
+
+    if (size == 0) {
+        pipe_size = 0;
+        return NO_STATUS;
+    }
+
+    if (pipe(test_fds) == -1) {
+        perror("pipe()");
+        return NO_STATUS;
+    }
+
+    size = resize_pipe(test_fds[1], size);
+    if (size == -1) {
+        perror("smallsh: pipesize");
+    } else {
+        pipe_size = size;
+    }
+
+    close(test_fds[0]);
+    close(test_fds[1]);
+
+    return NO_STATUS;
+}
+
+/**
+ * Writes the status of the last process to terminate into buf, of size
+ * bytes, as print_status() prints it but without the newline.
+ */
+void format_status(char *buf, size_t size) {
     switch (status.kind) {
         case EXIT_CODE:
-            printf("exit value %d\n", status.code);
-            fflush(stdout);
+            snprintf(buf, size, "exit value %d%s", status.code,
+                     status.timed_out ? " (timed out)" : "");
             break;
         case SIGNAL:
-            printf("terminated by signal %d\n", status.code);
-            fflush(stdout);
+            snprintf(buf, size, "terminated by signal %d%s", status.code,
+                     status.timed_out ? " (timed out)" : "");
             break;
         default:
-            printf("Error: invalid status code.\n");
-            fflush(stdout);
+            snprintf(buf, size, "Error: invalid status code.");
             break;
     }
 }
 
+/**
+ * Prints to stdout the status of the last process to terminate, noting if it
+ * was stopped for exceeding a time limit.
+ */
+void print_status(void) {
+    char buf[STATUS_LENGTH];
+
+    format_status(buf, sizeof(buf));
+    printf("%s\n", buf);
+    fflush(stdout);
+}
+
+/**
+ * Runs the status built-in, which prints the status of the last foreground
+ * command without changing it.
+ */
+int status_command(char *argv[], int argc, JobTable jobs) {
+    print_status();
+
+    return NO_STATUS;
+}
+
+/**
+ * Adds the resources counted in extra to total. Maximum resident set sizes
+ * are combined by taking the larger.
+ */
+void add_usage(struct rusage *total, struct rusage *extra) {
+    timeradd(&total->ru_utime, &extra->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &extra->ru_stime, &total->ru_stime);
+    if (extra->ru_maxrss > total->ru_maxrss) {
+        total->ru_maxrss = extra->ru_maxrss;
+    }
+    total->ru_nvcsw += extra->ru_nvcsw;
+    total->ru_nivcsw += extra->ru_nivcsw;
+}
+
+/**
+ * Prints the time elapsed since start, from CLOCK_MONOTONIC, and the CPU
+ * time, peak memory and context switches recorded in usage.
+ */
+void print_usage(struct timespec *start, struct rusage *usage) {
+    struct timespec now;
+    double real;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    real = (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+
+    printf("real %.3fs  user %.3fs  sys %.3fs  maxrss %ld KiB  "
+           "ctxsw %ld voluntary %ld involuntary\n",
+           real,
+           usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6,
+           usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6,
+           usage->ru_maxrss, usage->ru_nvcsw, usage->ru_nivcsw);
+    fflush(stdout);
+}
+
 /**
  * Sets the external Status struct.
  *
@@ -84,6 +352,36 @@ void print_status(void) {
 void set_status(int kind, int new_status) {
     status.kind = kind;
     status.code = new_status;
+    status.timed_out = false;
+}
+
+/**
+ * Returns whether the last process to terminate exited with status 0 within
+ * its time limit, so that the pipeline after && runs and the one after ||
+ * does not.
+ */
+bool status_succeeded(void) {
+    return status.kind == EXIT_CODE && status.code == 0 && !status.timed_out;
+}
+
+/**
+ * Subtracts the CPU time and context switches in earlier from usage, which
+ * must have been measured later for the same process.
+ */
+void sub_usage(struct rusage *usage, struct rusage *earlier) {
+    timersub(&usage->ru_utime, &earlier->ru_utime, &usage->ru_utime);
+    timersub(&usage->ru_stime, &earlier->ru_stime, &usage->ru_stime);
+    usage->ru_nvcsw -= earlier->ru_nvcsw;
+    usage->ru_nivcsw -= earlier->ru_nivcsw;
+}
+
+/**
+ * Updates the Status struct like update_status(), for a command that was
+ * signalled because it exceeded its time limit.
+ */
+void timeout_status(int wstatus) {
+    update_status(wstatus);
+    status.timed_out = true;
 }
 
 /**
@@ -100,3 +398,17 @@ void update_status(int wstatus) {
         set_status(SIGNAL, WTERMSIG(wstatus));
     }
 }
+
+/**
+ * Blocks until every background job, including queued ones, has finished.
+ *
+ * Ctrl-c ends the wait, and the status is then that of a program killed by
+ * SIGINT, as for sleep.
+ */
+int wait_command(char *argv[], int argc, JobTable jobs) {
+    if (wait_all(jobs)) {
+        return W_EXITCODE(0, SIGINT);
+    }
+
+    return NO_STATUS;
+}
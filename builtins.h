@@ -2,14 +2,47 @@
 #define BUILTINS_H
 
 #include "commands.h"
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <time.h>
+
+// Returned by built-ins that leave the status of the last command alone.
+#define NO_STATUS -1
+
+// Bytes format_status() needs, including the terminator.
+#define STATUS_LENGTH 64
+
+// A command that runs within the shell. run() returns the wait status the
+// command ends with, or NO_STATUS. Built-ins that are also programs are run
+// as those programs in the background, so that they do not hold up the shell.
+struct builtin {
+    char *name;
+    int (*run)(char *argv[], int argc, JobTable jobs);
+    bool is_program;
+};
 
 // Stub for status code struct. Implementation is in builtins.c.
 struct status;
 typedef struct status Status;
 
-void change_directory(char *argv[], int argc);
+extern int pipe_size;
+
+void add_usage(struct rusage *total, struct rusage *extra);
+int change_directory(char *argv[], int argc, JobTable jobs);
+int exit_command(char *argv[], int argc, JobTable jobs);
+struct builtin *find_builtin(char *name);
+void format_status(char *buf, size_t size);
+int hash_command(char *argv[], int argc, JobTable jobs);
+int jobs_command(char *argv[], int argc, JobTable jobs);
+int pipe_size_command(char *argv[], int argc, JobTable jobs);
 void print_status(void);
+void print_usage(struct timespec *start, struct rusage *usage);
 void set_status(int kind, int new_status);
+int status_command(char *argv[], int argc, JobTable jobs);
+bool status_succeeded(void);
+void sub_usage(struct rusage *usage, struct rusage *earlier);
+void timeout_status(int wstatus);
 void update_status(int wstatus);
+int wait_command(char *argv[], int argc, JobTable jobs);
 
 #endif
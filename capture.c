@@ -0,0 +1,456 @@
+/**
+ * Capture of the output of background jobs, and the output built-in that
+ * shows it.
+ *
+ * Usage:
+ *  output              list the jobs whose output is kept
+ *  output pid          print the output of the job whose pid is pid
+ *  output -c [N]       show, or set to N bytes, how much of each job's output
+ *                      is kept; 0, the default, turns capture off
+ *
+ * When capture is on, a background job's stderr, and its stdout unless it
+ * is redirected, go to a pipe that smallsh reads into a ring buffer, so only
+ * the last N bytes of a job's output are kept. Each ring is a memfd mapped
+ * into the shell, which holds no disk space and is released as a whole when
+ * the output is dropped.
+ *
+ * A running job holds N bytes of the CAPTURE_TOTAL_SIZE shared by all jobs.
+ * Once it has finished and its pipe is closed, its ring is cut down to the
+ * pages its output fills. When a new job would not fit, the output of the
+ * jobs that finished longest ago is dropped to make room; if running jobs
+ * alone fill it, the new job's output is not captured.
+ *
+ * The pipes are watched by an epoll instance of their own, which is added to
+ * the event loop, so they are drained both at the prompt and while the shell
+ * waits for a command.
+ */
+
+#define _GNU_SOURCE
+#include "capture.h"
+#include "builtins.h"
+#include "events.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Most pipes drained per wakeup of the event loop.
+#define CAPTURE_EVENTS 64
+
+/**
+ * The captured output of one background job.
+ *
+ * Fields:
+ * pid : the job's pid, or 0 until it has started
+ * pipe_fd : the end of the pipe smallsh reads, or -1 once every writer has
+ *      closed it
+ * write_fd : the end of the pipe given to the job, or -1 once it has started
+ * mem_fd : the memfd holding ring, or -1 once the output is complete
+ * ring : the last size bytes of output, mapped from mem_fd
+ * size : capacity of ring in bytes
+ * reserved : bytes of CAPTURE_TOTAL_SIZE taken by ring
+ * written : bytes of output received in all, of which the last size are kept
+ * finished : whether the job has been reaped
+ * prev, next : neighbours in the list of captures, whose complete captures
+ *      are in the order they completed
+ */
+struct capture {
+    pid_t pid;
+    int pipe_fd;
+    int write_fd;
+    int mem_fd;
+    char *ring;
+    size_t size;
+    size_t reserved;
+    uint64_t written;
+    bool finished;
+    struct capture *prev;
+    struct capture *next;
+};
+
+// Bytes of each job's output that are kept, or 0 when capture is off.
+size_t capture_size = 0;
+
+// Bytes of CAPTURE_TOTAL_SIZE taken by captures.
+size_t capture_reserved = 0;
+
+// Every capture, oldest first.
+struct capture *captures_head = NULL;
+struct capture *captures_tail = NULL;
+
+// Watches the pipes of running captures, or -1 before the first capture.
+int capture_epoll = -1;
+
+void append_capture(Capture cap);
+void captures_ready(int fd, void *data);
+void complete_capture(Capture cap);
+void drain_capture(Capture cap);
+void drop_capture(Capture cap);
+Capture find_capture(pid_t pid);
+bool make_room(size_t size);
+void print_capture(Capture cap);
+void unlink_capture(Capture cap);
+
+/**
+ * Adds cap to the end of the list of captures.
+ */
+void append_capture(Capture cap) {
+    cap->prev = captures_tail;
+    cap->next = NULL;
+    if (captures_tail != NULL) {
+        captures_tail->next = cap;
+    } else {
+        captures_head = cap;
+    }
+    captures_tail = cap;
+}
+
+/**
+ * Returns the descriptor a job should write its output to.
+ */
+int capture_fd(Capture cap) {
+    return cap->write_fd;
+}
+
+/**
+ * Returns whether any job's output pipe is still open, to be drained while
+ * the shell waits for a command.
+ */
+bool captures_open(void) {
+    for (Capture cap = captures_head; cap != NULL; cap = cap->next) {
+        if (cap->pipe_fd != -1) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Drains the pipes that have become readable.
+ */
+void captures_ready(int fd, void *data) {
+    struct epoll_event events[CAPTURE_EVENTS];
+    int ready = epoll_wait(fd, events, CAPTURE_EVENTS, 0);
+
+    for (int i = 0; i < ready; i++) {
+        drain_capture(events[i].data.ptr);
+    }
+}
+
+/**
+ * Cuts the ring of cap, whose job has finished and whose pipe is closed,
+ * down to the pages its output fills, and moves it to the end of the list,
+ * after the captures that completed before it.
+ */
+void complete_capture(Capture cap) {
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    if (cap->written < cap->size) {
+        size_t used = (cap->written + page - 1) / page * page;
+
+        if (ftruncate(cap->mem_fd, used) == 0) {
+            munmap(cap->ring + used, cap->size - used);
+            capture_reserved -= cap->reserved - used;
+            cap->reserved = used;
+        }
+    }
+
+    // The mapping keeps the memory once the descriptor is closed.
+    close(cap->mem_fd);
+    cap->mem_fd = -1;
+
+    unlink_capture(cap);
+    append_capture(cap);
+}
+
+/**
+ * Frees a capture whose job could not be started.
+ */
+void discard_capture(Capture cap) {
+    close(cap->write_fd);
+    cap->write_fd = -1;
+    drop_capture(cap);
+}
+
+/**
+ * Reads what is waiting in cap's pipe into its ring, overwriting the oldest
+ * output once the ring is full, and completes cap if it has ended.
+ */
+void drain_capture(Capture cap) {
+    while (cap->pipe_fd != -1) {
+        size_t pos = cap->written % cap->size;
+        ssize_t got = read(cap->pipe_fd, cap->ring + pos, cap->size - pos);
+
+        if (got > 0) {
+            cap->written += got;
+        } else if (got == -1 && errno == EINTR) {
+            continue;
+        } else if (got == -1 && errno == EAGAIN) {
+            break;
+        } else {
+            // Every writer has exited, or the pipe failed.
+            epoll_ctl(capture_epoll, EPOLL_CTL_DEL, cap->pipe_fd, NULL);
+            close(cap->pipe_fd);
+            cap->pipe_fd = -1;
+        }
+    }
+
+    if (cap->finished && cap->pipe_fd == -1 && cap->mem_fd != -1) {
+        complete_capture(cap);
+    }
+}
+
+/**
+ * Removes cap, releasing its ring and any descriptors still open.
+ */
+void drop_capture(Capture cap) {
+    if (cap->pipe_fd != -1) {
+        epoll_ctl(capture_epoll, EPOLL_CTL_DEL, cap->pipe_fd, NULL);
+        close(cap->pipe_fd);
+    }
+    if (cap->mem_fd != -1) {
+        close(cap->mem_fd);
+    }
+    if (cap->reserved > 0) {
+        munmap(cap->ring, cap->reserved);
+    }
+
+    capture_reserved -= cap->reserved;
+    unlink_capture(cap);
+    free(cap);
+}
+
+/**
+ * Returns the capture of the job whose pid is pid, or NULL if there is none.
+ */
+Capture find_capture(pid_t pid) {
+    // A pid may be reused, so look from the most recent.
+    for (Capture cap = captures_tail; cap != NULL; cap = cap->prev) {
+        if (cap->pid == pid) {
+            return cap;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Notes that the job of cap has been reaped, collecting what it wrote last.
+ * Its output is complete once any processes it left behind have closed the
+ * pipe too.
+ */
+void finish_capture(Capture cap) {
+    cap->finished = true;
+    drain_capture(cap);
+}
+
+/**
+ * Drops the output of the jobs that finished longest ago until size more
+ * bytes fit within CAPTURE_TOTAL_SIZE. Returns whether they fit.
+ */
+bool make_room(size_t size) {
+    Capture cap = captures_head;
+
+    while (capture_reserved + size > CAPTURE_TOTAL_SIZE && cap != NULL) {
+        Capture next = cap->next;
+
+        if (cap->mem_fd == -1) {
+            drop_capture(cap);
+        }
+        cap = next;
+    }
+
+    return capture_reserved + size <= CAPTURE_TOTAL_SIZE;
+}
+
+/**
+ * Creates a capture for a background job about to start, whose output
+ * should go to capture_fd(). Returns NULL if capture is off, or if there is
+ * no room for it, which is printed.
+ */
+Capture open_capture(void) {
+    int pipe_fds[2];
+    Capture cap;
+
+    if (capture_size == 0) {
+        return NULL;
+    }
+
+    if (capture_epoll == -1) {
+        capture_epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (capture_epoll == -1) {
+            perror("epoll_create1()");
+            return NULL;
+        }
+        add_busy_event(capture_epoll, captures_ready, NULL);
+    }
+
+    if (!make_room(capture_size)) {
+        printf("output not captured, capture memory is full\n");
+        fflush(stdout);
+        return NULL;
+    }
+
+    cap = calloc(1, sizeof(struct capture));
+    cap->size = capture_size;
+    cap->mem_fd = memfd_create("smallsh-output", MFD_CLOEXEC);
+    if (cap->mem_fd == -1 || ftruncate(cap->mem_fd, cap->size) == -1) {
+        perror("memfd_create()");
+        if (cap->mem_fd != -1) {
+            close(cap->mem_fd);
+        }
+        free(cap);
+        return NULL;
+    }
+
+    cap->ring = mmap(NULL, cap->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     cap->mem_fd, 0);
+    if (cap->ring == MAP_FAILED) {
+        perror("mmap()");
+        close(cap->mem_fd);
+        free(cap);
+        return NULL;
+    }
+
+    // smallsh reads its end without blocking, and the job inherits the other
+    // by dup2().
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        perror("pipe()");
+        munmap(cap->ring, cap->size);
+        close(cap->mem_fd);
+        free(cap);
+        return NULL;
+    }
+    fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+    cap->pipe_fd = pipe_fds[0];
+    cap->write_fd = pipe_fds[1];
+
+    cap->reserved = cap->size;
+    capture_reserved += cap->reserved;
+    append_capture(cap);
+
+    return cap;
+}
+
+/**
+ * Lists the captured outputs, or prints one, or shows or sets how much of
+ * each job's output is kept.
+ */
+int output_command(char *argv[], int argc, JobTable jobs) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    char *end;
+    long value;
+    Capture cap;
+
+    if (argc == 1) {
+        for (cap = captures_head; cap != NULL; cap = cap->next) {
+            if (cap->pid == 0) {
+                continue;
+            }
+            printf("%d %s %llu bytes", cap->pid,
+                   cap->finished ? "done" : "running",
+                   (unsigned long long)cap->written);
+            if (cap->written > cap->size) {
+                printf(", last %zu kept", cap->size);
+            }
+            printf("\n");
+        }
+        fflush(stdout);
+        return NO_STATUS;
+    }
+
+    if (strcmp(argv[1], "-c") == 0 && argc <= 3) {
+        if (argc == 2) {
+            printf("output capture %zu bytes per job\n", capture_size);
+            fflush(stdout);
+            return NO_STATUS;
+        }
+
+        value = strtol(argv[2], &end, 10);
+        if (*end != '\0' || argv[2][0] == '\0' || value < 0 ||
+            value > CAPTURE_TOTAL_SIZE) {
+            printf("smallsh: output: %s: invalid size\n", argv[2]);
+            fflush(stdout);
+            return NO_STATUS;
+        }
+
+        // Rings are mapped whole pages at a time.
+        capture_size = (value + page - 1) / page * page;
+        return NO_STATUS;
+    }
+
+    value = strtol(argv[1], &end, 10);
+    if (argc > 2 || *end != '\0' || argv[1][0] == '\0' || value <= 0 ||
+        value > INT_MAX) {
+        printf("smallsh: output: usage: output [pid | -c [N]]\n");
+        fflush(stdout);
+        return NO_STATUS;
+    }
+
+    cap = find_capture(value);
+    if (cap == NULL) {
+        printf("smallsh: output: %s: no output captured\n", argv[1]);
+        fflush(stdout);
+        return NO_STATUS;
+    }
+
+    drain_capture(cap);
+    print_capture(cap);
+    return NO_STATUS;
+}
+
+/**
+ * Writes the output kept in cap to stdout, oldest byte first.
+ */
+void print_capture(Capture cap) {
+    size_t pos = cap->written % cap->size;
+
+    if (cap->written > cap->size) {
+        fwrite(cap->ring + pos, 1, cap->size - pos, stdout);
+        fwrite(cap->ring, 1, pos, stdout);
+    } else {
+        fwrite(cap->ring, 1, cap->written, stdout);
+    }
+    fflush(stdout);
+}
+
+/**
+ * Marks cap as the output of the job whose pid is pid, which has started
+ * with its own copy of the pipe, and starts draining the pipe.
+ */
+void start_capture(Capture cap, pid_t pid) {
+    struct epoll_event event = {EPOLLIN};
+
+    cap->pid = pid;
+    close(cap->write_fd);
+    cap->write_fd = -1;
+
+    event.data.ptr = cap;
+    if (epoll_ctl(capture_epoll, EPOLL_CTL_ADD, cap->pipe_fd, &event) == -1) {
+        perror("epoll_ctl()");
+    }
+}
+
+/**
+ * Removes cap from the list of captures.
+ */
+void unlink_capture(Capture cap) {
+    if (cap->prev != NULL) {
+        cap->prev->next = cap->next;
+    } else {
+        captures_head = cap->next;
+    }
+    if (cap->next != NULL) {
+        cap->next->prev = cap->prev;
+    } else {
+        captures_tail = cap->prev;
+    }
+}
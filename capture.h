@@ -0,0 +1,25 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "processes.h"
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Most bytes the output of all background jobs may take up together.
+#define CAPTURE_TOTAL_SIZE (64 * 1024 * 1024)
+
+// Incomplete type to encapsulate its data structure.
+// The struct is implemented in capture.c.
+struct capture;
+
+typedef struct capture *Capture;
+
+int capture_fd(Capture cap);
+bool captures_open(void);
+void discard_capture(Capture cap);
+void finish_capture(Capture cap);
+Capture open_capture(void);
+int output_command(char *argv[], int argc, JobTable jobs);
+void start_capture(Capture cap, pid_t pid);
+
+#endif
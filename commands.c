@@ -1,75 +1,192 @@
+#define _GNU_SOURCE
 #include "commands.h"
 #include "builtins.h"
+#include "capture.h"
+#include "events.h"
+#include "memo.h"
+#include "pathcache.h"
+#include "placement.h"
 #include "processes.h"
+#include "script.h"
+#include "sha256.h"
+#include "tokenize.h"
+#include "trace.h"
+#include "utilities.h"
+#include "wildcard.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+// How a pipeline of a command list depends on the status of the one before.
+enum list_op { LIST_SEQ, LIST_AND, LIST_OR };
+
 /*
  * Represents a parsed smallsh command entered at the prompt.
  *
  * Adapted from sample_parser.c
  *
  * Fields:
- * argv : array of char* pointers, one for each argument
+ * argv : array of char* pointers, one for each argument, with room for a
+ *      terminating NULL
  * argc : the count of command arguments
+ * arg_capacity : the number of pointers argv has room for
+ * has_patterns : whether any argument may be a wildcard pattern, to be
+ *      expanded when the command runs
  * in_file : name of a file from which to read input
  * out_file : name of a file from to which to write output
  * is_bg : whether to run the command as a background process
+ * is_timed : whether to report the resources the command used, as requested
+ *      by a leading time keyword
+ * time_limit : seconds the command may run before it is sent SIGTERM, or 0
+ *      for no limit, as set by a leading limit -t keyword
+ * kill_grace : seconds after SIGTERM before SIGKILL, or 0 for none, as set
+ *      by limit -k
+ * is_memo : whether to replay the output of an identical earlier run, as
+ *      requested by a leading memo keyword
+ * memo_vars : the environment variables named by memo -e
+ * next : the following stage of a pipeline, or NULL for the last stage
+ * list_op : how the pipeline follows the one before it in a command list,
+ *      after ; or & (LIST_SEQ), && (LIST_AND) or || (LIST_OR)
+ * next_list : the first stage of the following pipeline of a command list,
+ *      or NULL for the last pipeline
  *
  * Entered commands may be accessed in order via
  * command_entry.argv[command_entry.argc].
  * Or, via struct command_entry* pointer: cmd->argv[cmg->argc].
  *
+ * A pipeline is a list of command entries linked by next. Only the first
+ * stage may have an in_file, only the last may have an out_file, and is_bg is
+ * set on the first stage for the pipeline as a whole.
+ *
+ * A command list is a list of pipelines linked by next_list, the fields of
+ * which, like is_bg and the prefixes, are set on their first stages only.
+ *
+ * Commands are allocated from an arena and their strings point into the
+ * parsed line, so a command is valid until both the arena is reset and the
+ * line is reused.
  */
 struct command_entry {
-    char *argv[MAX_ARGS + 1];
+    char **argv;
     int argc;
+    int arg_capacity;
+    bool has_patterns;
     char *in_file;
     char *out_file;
     bool is_bg;
+    bool is_timed;
+    double time_limit;
+    double kill_grace;
+    bool is_memo;
+    struct memo_var *memo_vars;
+    struct command_entry *next;
+    enum list_op list_op;
+    struct command_entry *next_list;
+};
+
+/**
+ * An environment variable whose value a memo command's output depends on.
+ */
+struct memo_var {
+    char *name;
+    struct memo_var *next;
 };
 
+extern char **environ;
+
 void handle_fg_SIGINT(int signo) {
     _exit(EXIT_SUCCESS);
 }
 
 /*
- * Parses a smallsh command entered at the prompt.
+ * Parses a smallsh command line.
  *
  * This parse command is adapted from sample_parse.c
  *
- * The prompt is a colon, and the syntax for a command is:
- *  : command [arg1 arg2 arg3 ...] [< input_filename] [> output_filename] [&]
+ * The syntax for a command is:
+ *  [time] [limit -t duration [-k duration]] [memo [-e name ...]]
+ *      command [arg1 arg2 arg3 ...] [< input_filename] [| command ...]
+ *      [> output_filename] [&]
+ *
+ * Commands separated by a vertical bar form a pipeline, the stdout of each
+ * connected to the stdin of the next.
  *
  * The concluding ampersand is for running a command as a background process.
- * It must be the last character of a command, else it is interpreted as text.
+ * It must be a word of its own, else it is interpreted as text.
+ *
+ * Pipelines separated by ;, &, && or || form a command list, run one after
+ * another: after && only if the one before succeeded, after || only if it
+ * did not. Each pipeline takes its own prefixes, and & puts only the
+ * pipeline it ends in the background. A list may end with ; or &.
  *
- * Input is retrieved from stdin, set to a maximum of INPUT_LENGTH characters.
- * It is tokenized at spaces and a terminating newline.
+ * The line is tokenized in place at spaces, tabs and newlines by the vector
+ * tokenizer in tokenize.c, and the command is allocated from
+ * arena, so parsing copies no strings and there is no limit on the number of
+ * arguments.
+ *
+ * Errors are printed, and NULL returned for them as for blank lines and
+ * comments.
+ */
+Command parse_command(Arena arena, char *input, int fg_only) {
+    char *error;
+    Command cmd = parse_line(arena, input, fg_only, &error);
+
+    if (error != NULL) {
+        parse_error(error);
+    }
+
+    return cmd;
+}
+
+/**
+ * Prints the message of a line that could not be parsed.
+ */
+void parse_error(char *error) {
+    printf("Error: %s\n", error);
+    fflush(stdout);
+}
+
+/**
+ * Parses a command line as parse_command() does, but without printing
+ * errors. Stores in error the message of a line that cannot be parsed, else
+ * NULL, and returns the command, or NULL for a blank line, a comment or an
+ * error.
  */
-Command parse_command(int fg_only) {
-    char input[INPUT_LENGTH] = {0};
-    Command cmd = (Command)calloc(1, sizeof(struct command_entry));
+Command parse_line(Arena arena, char *input, int fg_only, char **error_out) {
+    Command list = new_stage(arena);
+    Command cmd = list;
+    Command stage = cmd;
+    char *error = NULL;
 
     // To ensure that i/o redirection occurs after command and arguments.
     int args_done = 0;
 
-    // Print prompt.
-    printf(PROMPT);
-    fflush(stdout);
+    // Whether a limit keyword has been read, and the option of limit whose
+    // value comes next, if any.
+    bool in_limit = false;
+    char limit_option = '\0';
+    double seconds;
 
-    // Get input from user.
-    fgets(input, INPUT_LENGTH, stdin);
+    // Whether the name of a variable for memo -e comes next.
+    bool memo_var_next = false;
 
     // Tokenize input into commands.
-    char *cmd_tok_ptr;
-    char *token = strtok_r(input, " \n", &cmd_tok_ptr);
+    struct tokenizer tok;
+    enum token_kind kind;
+    init_tokenizer(&tok, arena, input, strlen(input));
+    char *token = next_token(&tok, &kind);
+
+    *error_out = NULL;
 
     // Check for blank line.
     if (token == NULL) {
@@ -81,285 +198,1598 @@ Command parse_command(int fg_only) {
         return NULL;
     }
 
-    while (token != NULL) {
-        if (strcmp(token, "<") == 0) {
+    while (error == NULL) {
+        if (token == NULL || kind == TOKEN_BG || kind == TOKEN_SEQ ||
+            kind == TOKEN_AND || kind == TOKEN_OR) {
+            // The end of a pipeline, and of the list if token is NULL.
+            if (token != NULL && kind == TOKEN_BG && !fg_only) {
+                // Run as background job unless foreground-only mode is on.
+                cmd->is_bg = true;
+            }
+
+            if (limit_option != '\0') {
+                error = "missing duration for limit";
+            } else if (memo_var_next) {
+                error = "missing variable name for memo -e";
+            } else if (cmd->is_memo && cmd->is_bg) {
+                error = "memo commands cannot run in the background";
+            } else if (in_limit && cmd->time_limit == 0) {
+                error = "limit requires -t duration";
+            } else if (stage->argc == 0 && stage != cmd) {
+                error = "missing command after |";
+            } else if (stage->argc == 0 && token != NULL) {
+                error = kind == TOKEN_SEQ   ? "missing command before ;"
+                        : kind == TOKEN_AND ? "missing command before &&"
+                        : kind == TOKEN_OR  ? "missing command before ||"
+                                            : "missing command before &";
+            } else if (stage->argc == 0) {
+                error = cmd->list_op == LIST_AND  ? "missing command after &&"
+                        : cmd->list_op == LIST_OR ? "missing command after ||"
+                                                  : "missing command";
+            }
+            if (error != NULL || token == NULL) {
+                break;
+            }
+
+            // Start the next pipeline of the list, unless a ; or & ends it.
+            enum list_op op = kind == TOKEN_AND  ? LIST_AND
+                              : kind == TOKEN_OR ? LIST_OR
+                                                 : LIST_SEQ;
+            token = next_token(&tok, &kind);
+            if (token == NULL && op == LIST_SEQ) {
+                break;
+            }
+            cmd->next_list = new_stage(arena);
+            cmd = cmd->next_list;
+            cmd->list_op = op;
+            stage = cmd;
+            args_done = 0;
+            in_limit = false;
+            continue;
+        } else if (kind == TOKEN_IN) {
             // Redirect stdin.
-            cmd->in_file = strdup(strtok_r(NULL, " \n", &cmd_tok_ptr));
+            token = next_token(&tok, &kind);
+            if (token == NULL) {
+                error = "missing input file after <";
+            } else if (stage != cmd) {
+                error = "only the first command of a pipeline may "
+                        "redirect input";
+            } else {
+                stage->in_file = token;
+            }
             args_done = 1;
-        } else if (strcmp(token, ">") == 0) {
+        } else if (kind == TOKEN_OUT) {
             // Redirect stdout.
-            cmd->out_file = strdup(strtok_r(NULL, " \n", &cmd_tok_ptr));
+            token = next_token(&tok, &kind);
+            if (token == NULL) {
+                error = "missing output file after >";
+            } else {
+                stage->out_file = token;
+            }
             args_done = 1;
-        } else if (strcmp(token, "&") == 0) {
-            if (!fg_only) {
-                // Run as background job unless foreground-only mode is on.
-                cmd->is_bg = true;
+        } else if (kind == TOKEN_PIPE) {
+            // Start the next stage of a pipeline.
+            if (stage->argc == 0) {
+                error = "missing command before |";
+            } else if (stage->out_file != NULL) {
+                error = "only the last command of a pipeline may "
+                        "redirect output";
+            } else {
+                stage->next = new_stage(arena);
+                stage = stage->next;
+                args_done = 0;
+            }
+        } else if (memo_var_next) {
+            struct memo_var *var = arena_alloc(arena, sizeof(struct memo_var));
+
+            var->name = token;
+            var->next = cmd->memo_vars;
+            cmd->memo_vars = var;
+            memo_var_next = false;
+        } else if (cmd->is_memo && stage == cmd && cmd->argc == 0 &&
+                   strcmp(token, "-e") == 0) {
+            memo_var_next = true;
+        } else if (stage == cmd && cmd->argc == 0 && !cmd->is_memo &&
+                   strcmp(token, "memo") == 0) {
+            // A leading memo keyword replays the output of an earlier run.
+            cmd->is_memo = true;
+        } else if (limit_option != '\0') {
+            // The duration following -t or -k.
+            if (parse_duration(token, &seconds) == -1 ||
+                (limit_option == 't' && seconds == 0)) {
+                error = "invalid duration for limit";
+            } else if (limit_option == 't') {
+                cmd->time_limit = seconds;
+            } else {
+                cmd->kill_grace = seconds;
             }
+            limit_option = '\0';
+        } else if (in_limit && stage == cmd && cmd->argc == 0 &&
+                   (strcmp(token, "-t") == 0 || strcmp(token, "-k") == 0)) {
+            limit_option = token[1];
+        } else if (stage == cmd && cmd->argc == 0 && !in_limit &&
+                   strcmp(token, "limit") == 0) {
+            // A leading limit keyword bounds how long the command may run.
+            in_limit = true;
+            cmd->kill_grace = LIMIT_GRACE;
+        } else if (stage == cmd && cmd->argc == 0 && !cmd->is_timed &&
+                   strcmp(token, "time") == 0) {
+            // A leading time keyword reports the command's resource use.
+            cmd->is_timed = true;
         } else if (!args_done) {
             // Add to list of arguments.
-            cmd->argv[cmd->argc++] = strdup(token);
-            // cmd->argc tracks the cmd->argv subscript for the current token,
-            // incrementing so that it reflects the total number of tokens
-            // stored.
+            add_arg(arena, stage, token);
+            if (kind == TOKEN_PATTERN) {
+                stage->has_patterns = true;
+            }
         } else {
             // More command arguments were received after redirection.
-            printf("Error: command arguments must precede input/output "
-                   "redirection.\n");
-            fflush(stdout);
-            return NULL;
+            error = "command arguments must precede input/output "
+                    "redirection.";
         }
 
-        token = strtok_r(NULL, " \n", &cmd_tok_ptr);
+        token = next_token(&tok, &kind);
     }
 
-    return cmd;
+    if (error != NULL) {
+        *error_out = error;
+        return NULL;
+    }
+
+    return list;
+}
+
+/**
+ * Runs the command list cmd, one pipeline after another. A pipeline after &&
+ * runs only if the status update_status() last recorded is success, and one
+ * after || only if it is not, so a skipped pipeline leaves the status as it
+ * was for the next. A Ctrl-c stops the rest of the list.
+ *
+ * The patterns of each pipeline are expanded into arena just before it runs,
+ * so that they match the files the pipelines before it have left.
+ */
+void process_command(Arena arena, Command cmd, JobTable jobs) {
+    for (; cmd != NULL; cmd = cmd->next_list) {
+        if ((cmd->list_op == LIST_AND && !status_succeeded()) ||
+            (cmd->list_op == LIST_OR && status_succeeded())) {
+            continue;
+        }
+
+        expand_wildcards(arena, cmd);
+        run_pipeline(cmd, jobs);
+
+        read_signals();
+        if (cmd->next_list != NULL && take_signal(SIGINT)) {
+            break;
+        }
+    }
+}
+
+/**
+ * Returns whether a pipeline of the command list cmd may read smallsh's own
+ * stdin: a foreground pipeline without < that runs a program, or parallel
+ * reading its inputs. Built-ins otherwise leave stdin alone, and background
+ * pipelines read /dev/null.
+ */
+bool reads_stdin(Command cmd) {
+    for (; cmd != NULL; cmd = cmd->next_list) {
+        struct builtin *builtin =
+            cmd->next == NULL ? find_builtin(cmd->argv[0]) : NULL;
+
+        if (cmd->is_bg || cmd->in_file != NULL) {
+            continue;
+        }
+        if (builtin == NULL || (cmd->time_limit > 0 && builtin->is_program) ||
+            strcmp(builtin->name, "parallel") == 0) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 /*
- * Dispatcher function for running a parsed command.
+ * Dispatcher function for running a parsed pipeline.
  *
- * First checks whether the command is one of smallsh's three built-ins:
+ * First looks the command up among smallsh's built-ins (see builtins.c):
  *  - exit : exits the shell, killing any processes or jobs it has started
  *  - cd : changes the working directory, using absolute or relative paths
  *  - status : prints either the exit status or the terminating signal of the
  *      last foreground process run by smallsh
+ *  - hash : lists, adds to, or clears the cache of command locations
+ *  - history : shows the command history, or its entries with a prefix
+ *  - pipesize : shows or sets the buffer size of pipes between commands
+ *  - jobs : lists background jobs, or shows or sets how many run at once
+ *  - wait : waits for all background jobs, including queued ones, to finish
+ *  - parallel : runs a command template over a list of inputs, several at a
+ *      time, with the number of failed jobs as its status
+ *  - output : shows the captured output of background jobs
+ *  - place : sets the CPUs and priorities background jobs run with
+ *  - echo, true, false, test, [, pwd, printf, sleep : utilities that run
+ *      in-process instead of as programs, and set the status as they would
  *
- *  No i/o redirection, background argument is ignored, no exit status is set.
+ *  Built-ins take i/o redirection, applied to the shell's own stdin and
+ *  stdout for as long as they run. The shell's commands ignore the background
+ *  argument, while the utilities run in the background as programs.
+ *  Built-ins are only recognized as single commands, not pipeline stages.
  *
  *  If the command is not a built-in, then it sends the command to a generic
- *  execution function.
- */
-Process process_command(Command cmd, Process procs) {
-    // Check for built-in commands.
-    if (strcmp(cmd->argv[0], "exit") == 0) {
-        // Terminate all running processes and jobs.
-        kill_all(procs);
-
-        exit(EXIT_SUCCESS);
-    } else if (strcmp(cmd->argv[0], "cd") == 0) {
-        change_directory(cmd->argv, cmd->argc);
-    } else if (strcmp(cmd->argv[0], "status") == 0) {
-        // Display status of last foreground process via stdout.
-        print_status();
-    } else if (cmd->is_bg) {
-        // Process is set to run in the background.
-        procs = background_command(cmd, procs);
-    } else {
-        // Not a built-in, so fork a child process to run the command.
-        execute_command(cmd);
+ *  execution function, by way of the memo cache for a memo command.
+ */
+void run_pipeline(Command cmd, JobTable jobs) {
+    struct builtin *builtin = cmd->next == NULL ? find_builtin(cmd->argv[0])
+                                                : NULL;
+    struct rusage before, after, children_before, children_after;
+    struct timespec start;
+
+    // A utility run in the background or under a time limit is run as its
+    // program instead.
+    if (builtin == NULL ||
+        ((cmd->is_bg || cmd->time_limit > 0) && builtin->is_program)) {
+        if (cmd->is_bg) {
+            // Process is set to run in the background.
+            background_command(cmd, jobs, NULL, NULL, -1);
+        } else if (cmd->is_memo) {
+            memo_command(cmd, jobs);
+        } else {
+            // Not a built-in, so fork a child process to run the command.
+            execute_command(cmd, jobs);
+        }
+        return;
+    }
+
+    // Built-ins run in the shell itself, so their time is the shell's, plus
+    // that of any children they wait for.
+    if (cmd->is_timed) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        getrusage(RUSAGE_SELF, &before);
+        getrusage(RUSAGE_CHILDREN, &children_before);
+    }
+
+    run_builtin(builtin, cmd, jobs);
+
+    if (cmd->is_timed) {
+        getrusage(RUSAGE_SELF, &after);
+        getrusage(RUSAGE_CHILDREN, &children_after);
+        sub_usage(&after, &before);
+        sub_usage(&children_after, &children_before);
+        add_usage(&after, &children_after);
+        print_usage(&start, &after);
     }
-    return procs;
 }
 
-void execute_command(Command cmd) {
-    pid_t spawn_pid, child_pid;
-    int result;
+/**
+ * Runs builtin for cmd within the shell. Its redirections are applied to the
+ * shell's own stdin and stdout, which are saved and restored afterwards, and
+ * the status it returns becomes that of the last foreground command.
+ */
+void run_builtin(struct builtin *builtin, Command cmd, JobTable jobs) {
+    int saved_in = -1, saved_out = -1;
+    int result = W_EXITCODE(EXIT_FAILURE, 0);
 
-    // This switch statement idea is from Dr. Guillermo Tonsmann's
-    // "Processes" pdf, p.30.
-    switch (spawn_pid = fork()) {
-        case -1:
-            perror("fork() failed");
-            exit(EXIT_FAILURE);
+    // Output already buffered belongs to the shell's stdout.
+    fflush(stdout);
 
-        case 0: // Child process.
-            if (cmd->in_file != NULL) {
-                result = redirect_in(cmd->in_file);
-                if (result) {
-                    _exit(EXIT_FAILURE);
-                    // parent process takes care of updating status
-                }
-            }
+    if (cmd->in_file != NULL) {
+        saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+    }
+    if (cmd->out_file != NULL) {
+        saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    }
 
-            if (cmd->out_file != NULL) {
-                result = redirect_out(cmd->out_file);
-                if (result) {
-                    _exit(EXIT_FAILURE);
-                    // parent process takes care of updating status
-                }
-            }
+    if ((cmd->in_file == NULL || redirect_in(cmd->in_file) == 0) &&
+        (cmd->out_file == NULL || redirect_out(cmd->out_file) == 0)) {
+        TRACE(TRACE_BUILTIN_START, 0, 0);
+        result = builtin->run(cmd->argv, cmd->argc, jobs);
+        TRACE(TRACE_BUILTIN_END, 0, result);
+    }
+    fflush(stdout);
 
-            // Append a NULL to the array of args for the execvp call.
-            cmd->argv[cmd->argc] = NULL;
+    if (cmd->in_file != NULL) {
+        restore_fd(saved_in, STDIN_FILENO);
+    }
+    if (cmd->out_file != NULL) {
+        restore_fd(saved_out, STDOUT_FILENO);
+    }
 
-            struct sigaction SIGINT_action = {0};
-            struct sigaction SIGTSTP_action = {0};
+    if (result != NO_STATUS) {
+        update_status(result);
+        if (WIFSIGNALED(result)) {
+            print_status();
+        }
+    }
+}
 
-            /* These lines are adapted from "Exploration: Signal Handling API".
-             * https://canvas.oregonstate.edu/courses/1987883/pages/exploration-signal-handling-api?module_item_id=24956227
-             * 2025-02-18
-             */
-            // Register handler for SIGINT.
-            // This will not apply to exec() commands.
-            SIGINT_action.sa_handler = handle_fg_SIGINT;
-            // Block catchable signals while SIGINT is running.
-            sigfillset(&SIGINT_action.sa_mask);
-            // No flags.
-            SIGINT_action.sa_flags = 0;
-            // Install the handler.
-            sigaction(SIGINT, &SIGINT_action, NULL);
+/**
+ * Moves the descriptor saved from fd by run_builtin() back into place. If fd
+ * was closed, it is closed again.
+ */
+void restore_fd(int saved_fd, int fd) {
+    if (saved_fd == -1) {
+        close(fd);
+        return;
+    }
 
-            // Register handler to ignore SIGTSTP.
-            // This will apply to exec() commands.
-            SIGTSTP_action.sa_handler = SIG_IGN;
-            // Install the handler.
-            sigaction(SIGTSTP, &SIGTSTP_action, NULL);
+    dup2(saved_fd, fd);
+    close(saved_fd);
+}
 
-            // The child process executes the command.
-            execvp(cmd->argv[0], cmd->argv);
+/**
+ * Runs a command or pipeline in the foreground, waiting for every stage to
+ * terminate. The status of the last stage becomes smallsh's status.
+ *
+ * If cmd is timed, the elapsed time and the resources used by all of its
+ * stages are printed once they have terminated.
+ *
+ * A pipeline with a time limit runs in a process group of its own, so that
+ * the signals sent when its time is up reach every process it has started,
+ * and is given the terminal while it runs if smallsh has it.
+ *
+ * Returns the wait status of the last stage, or -1 if a stage could not be
+ * started or the command was stopped for exceeding its time limit.
+ */
+int execute_command(Command cmd, JobTable jobs) {
+    int stages = count_stages(cmd);
+    pid_t pids[stages];
+    int started, result = 0;
+    struct rusage usage = {0}, stage_usage;
+    struct timespec start, timeout;
+    double deadline = 0, now;
+    bool own_group = cmd->time_limit > 0;
+    bool timed_out = false, has_terminal = false;
 
-            perror("execvp()");
-            _exit(EXIT_FAILURE);
-            // parent process takes care of updating status
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    started = start_pipeline(cmd, false, own_group, -1, pids);
+    if (cmd->time_limit > 0) {
+        deadline = monotonic_time() + cmd->time_limit;
+    }
 
-            break;
+    // A stage that touched the terminal before it was handed over has been
+    // stopped, and is continued.
+    if (own_group && started > 0 && tcgetpgrp(STDIN_FILENO) == getpgrp()) {
+        has_terminal = set_terminal(pids[0]);
+        kill(-pids[0], SIGCONT);
+    }
 
-        default:
-            // The parent process waits for the child process to terminate.
-            child_pid = waitpid(spawn_pid, &result, 0);
+    // The parent process waits for the child processes to terminate. With no
+    // deadline to keep, for this command or a background job, and no
+    // background output to capture, it simply blocks until each one does.
+    for (int i = 0; i < started; i++) {
+        bool watch = deadline > 0 || has_deadlines(jobs) || captures_open();
+        pid_t reaped;
 
-            // Update smallsh's Status.
-            update_status(result);
+        while ((reaped = wait4(pids[i], &result, watch ? WNOHANG : 0,
+                               &stage_usage)) == 0) {
+            now = monotonic_time();
+            if (deadline > 0 && now >= deadline) {
+                // Signal the pipeline's process group: SIGTERM at the time
+                // limit, then SIGKILL once the grace period is over.
+                kill(-pids[0], timed_out ? SIGKILL : SIGTERM);
+                deadline = !timed_out && cmd->kill_grace > 0
+                               ? now + cmd->kill_grace
+                               : 0;
+                timed_out = true;
+                continue;
+            }
 
-            if (WIFSIGNALED(result)) {
-                print_status();
+            // Background deadlines and captures are kept while waiting.
+            if (deadline > 0) {
+                timeout.tv_sec = deadline - now;
+                timeout.tv_nsec = (deadline - now - timeout.tv_sec) * 1e9;
             }
+            wait_signal(SIGCHLD, deadline > 0 ? &timeout : NULL);
+        }
 
-            break;
+        if (reaped != -1) {
+            TRACE(TRACE_REAP, pids[i], result);
+            add_usage(&usage, &stage_usage);
+        }
+    }
+
+    // A Ctrl-c that went to the pipeline's group rather than smallsh still
+    // stops the rest of a command list.
+    if (has_terminal) {
+        set_terminal(getpgrp());
+        if (started == stages && WIFSIGNALED(result) &&
+            WTERMSIG(result) == SIGINT) {
+            keep_signal(SIGINT);
+        }
     }
+
+    if (cmd->is_timed) {
+        print_usage(&start, &usage);
+    }
+
+    if (started < stages) {
+        // Same status as a child that could not redirect its i/o or exec.
+        update_status(W_EXITCODE(EXIT_FAILURE, 0));
+        return -1;
+    }
+
+    // Update smallsh's Status.
+    if (timed_out) {
+        timeout_status(result);
+        print_status();
+        return -1;
+    }
+    update_status(result);
+
+    if (WIFSIGNALED(result)) {
+        print_status();
+    }
+
+    return result;
 }
 
-Process background_command(Command cmd, Process procs) {
-    pid_t spawn_pid;
-    int result;
+/**
+ * Runs a command or pipeline in the foreground through the memo cache. If
+ * an earlier run with the same key (see memo_key()) is cached, its output
+ * and status are replayed without starting a process. Otherwise the command
+ * runs with its output going to a new cache entry, which is then replayed,
+ * so the output appears once the command has finished.
+ *
+ * Output redirected with > is written from the cache to the file.
+ */
+void memo_command(Command cmd, JobTable jobs) {
+    unsigned char key[SHA256_SIZE];
+    Command last = cmd;
+    char *out_file, *entry;
+    struct timespec start;
+    struct rusage none = {0};
+    int fd, wstatus;
+    off_t size;
 
-    switch (spawn_pid = fork()) {
-        case -1:
-            perror("fork() failed");
-            exit(EXIT_FAILURE);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (last->next != NULL) {
+        last = last->next;
+    }
+    out_file = last->out_file;
+    memo_key(cmd, key);
 
-        case 0: // Child process.
-            // Must redirect i/o.
-            if (cmd->in_file == NULL) {
-                result = redirect_in("/dev/null");
-            } else {
-                result = redirect_in(cmd->in_file);
-            }
-            if (result) {
-                _exit(EXIT_FAILURE);
-            }
+    fd = memo_lookup(key, &wstatus, &size);
+    if (fd != -1) {
+        update_status(wstatus);
+        if (cmd->is_timed) {
+            print_usage(&start, &none);
+        }
+    } else if ((entry = memo_begin()) != NULL) {
+        last->out_file = entry;
+        wstatus = execute_command(cmd, jobs);
+        last->out_file = out_file;
+        fd = memo_store(key, wstatus, &size);
+    } else {
+        execute_command(cmd, jobs);
+        return;
+    }
 
-            if (cmd->out_file == NULL) {
-                result = redirect_out("/dev/null");
-            } else {
-                result = redirect_out(cmd->out_file);
-            }
-            if (result) {
-                _exit(EXIT_FAILURE);
-            }
+    if (fd != -1) {
+        memo_replay(fd, size, out_file);
+        close(fd);
+    }
+}
 
-            // Set background process to ignore SIGINT and SIGTSTP signals.
-            // Ignored signals apply to commands called with exec().
-            struct sigaction SIGINT_action = {0};
-            struct sigaction SIGTSTP_action = {0};
+/**
+ * Computes the key of cmd's entry in the memo cache: a SHA-256 of all that
+ * its output is taken to depend on. That is the working directory, the
+ * arguments of every stage and the identity, size and modification time of
+ * the file each stage runs, the same of the input file, and the values of
+ * the environment variables named with memo -e.
+ */
+void memo_key(Command cmd, unsigned char key[SHA256_SIZE]) {
+    struct sha256 ctx;
+    char cwd[PATH_MAX];
 
-            // Register handler to ignore SIGINT.
-            SIGINT_action.sa_handler = SIG_IGN;
-            // Install the handler.
-            sigaction(SIGINT, &SIGINT_action, NULL);
+    sha256_init(&ctx);
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        sha256_update(&ctx, cwd, strlen(cwd) + 1);
+    }
 
-            // Register handler to ignore SIGTSTP.
-            SIGTSTP_action.sa_handler = SIG_IGN;
-            // Install the handler.
-            sigaction(SIGTSTP, &SIGTSTP_action, NULL);
+    for (Command stage = cmd; stage != NULL; stage = stage->next) {
+        char *path = hash_lookup(stage->argv[0]);
 
-            // Append a NULL to the array of args for the execvp call.
-            cmd->argv[cmd->argc] = NULL;
+        for (int i = 0; i < stage->argc; i++) {
+            sha256_update(&ctx, stage->argv[i], strlen(stage->argv[i]) + 1);
+        }
+        sha256_update(&ctx, "|", 2);
+        memo_key_file(&ctx, path != NULL ? path : stage->argv[0]);
+    }
 
-            // The child process executes the command.
-            execvp(cmd->argv[0], cmd->argv);
+    if (cmd->in_file != NULL) {
+        sha256_update(&ctx, "<", 2);
+        memo_key_file(&ctx, cmd->in_file);
+    }
 
-            perror("execvp()");
-            _exit(EXIT_FAILURE);
-            // parent process takes care of updating status
+    for (struct memo_var *var = cmd->memo_vars; var != NULL; var = var->next) {
+        char *value = getenv(var->name);
 
-            break;
+        // An unset variable differs from an empty one.
+        sha256_update(&ctx, var->name, strlen(var->name) + 1);
+        sha256_update(&ctx, value != NULL ? "=" : "", value != NULL ? 1 : 0);
+        if (value != NULL) {
+            sha256_update(&ctx, value, strlen(value) + 1);
+        }
+    }
 
-        default: // Parent process.
-            // Save process in list so that it may be terminated upon smallsh
-            // exit.
-            procs = add_proc(procs, spawn_pid);
+    sha256_final(&ctx, key);
+}
 
-            // Print the PID of the background process when it begins.
-            printf("background pid is %d\n", spawn_pid);
-            fflush(stdout);
+/**
+ * Adds the name of a file to a memo key, and which file it is, its size and
+ * when it was last modified, so that changing or replacing the file changes
+ * the key.
+ */
+void memo_key_file(struct sha256 *ctx, char *path) {
+    struct {
+        uint64_t dev, ino, size;
+        int64_t sec, nsec;
+    } id = {0};
+    struct stat st;
 
-            // Return to the prompt.
-            break;
+    if (stat(path, &st) == 0) {
+        id.dev = st.st_dev;
+        id.ino = st.st_ino;
+        id.size = st.st_size;
+        id.sec = st.st_mtim.tv_sec;
+        id.nsec = st.st_mtim.tv_nsec;
     }
 
-    return procs;
+    sha256_update(ctx, path, strlen(path) + 1);
+    sha256_update(ctx, &id, sizeof(id));
 }
 
 /**
- * Redirects stdin file descriptor to the specified pathname.
- *
- * This function prints any errors encountered.
+ * Runs a command or pipeline in the background, or, if the concurrency limit
+ * of jobs is reached, queues a copy of it to start when a running job
+ * finishes.
  *
- * Returns 0 if successful, 1 if not.
+ * A job started for a client of the server gives notify, which is called
+ * with data when the job finishes instead of the job being reported on the
+ * console, and out_fd, to which its output goes, or -1 for none. Other jobs
+ * give NULL and -1.
  */
-int redirect_in(char *infile) {
-    int newfd;
+void background_command(Command cmd, JobTable jobs, JobNotify notify,
+                        void *data, int out_fd) {
+    if (!job_slot_free(jobs)) {
+        int waiting = queue_job(jobs, copy_command(cmd), notify, data, out_fd);
 
-    // Open file to read from for stdin redirection.
-    newfd = open(infile, O_RDONLY);
-    if (newfd == -1) {
-        printf("cannot open %s for input\n", infile);
-        return 1;
+        if (notify == NULL) {
+            printf("background job queued, %d waiting\n", waiting);
+            fflush(stdout);
+        }
+        return;
     }
 
-    // Redirect stdin to infile's fd.
-    newfd = dup2(newfd, STDIN_FILENO);
-    if (newfd == -1) {
-        perror("dup2");
-        return 1;
+    start_background(cmd, jobs, notify, data, out_fd);
+}
+
+/**
+ * Runs cmd for a client of the server, as a background job that calls
+ * notify with data when it finishes and writes its output to out_fd, as by
+ * background_command(). Built-ins that would run within the server itself,
+ * memo commands and command lists are refused, while the utilities run as
+ * their programs.
+ *
+ * Returns NULL if the job was started or queued, else the reason it was not.
+ */
+char *client_command(Command cmd, JobTable jobs, JobNotify notify, void *data,
+                     int out_fd) {
+    struct builtin *builtin = cmd->next == NULL ? find_builtin(cmd->argv[0])
+                                                : NULL;
+
+    if (builtin != NULL && !builtin->is_program) {
+        return "built-ins of the shell cannot be run by clients";
+    }
+    if (cmd->is_memo) {
+        return "memo commands cannot be run by clients";
+    }
+    if (cmd->next_list != NULL) {
+        return "command lists cannot be run by clients";
     }
 
-    return 0;
+    background_command(cmd, jobs, notify, data, out_fd);
+    return NULL;
 }
 
 /**
- * Redirects stdout file descriptor to the specified pathname.
- *
- * This function prints any errors encountered.
+ * Starts a command or pipeline in the background in a process group of its
+ * own, adding it to jobs under the pid of its last stage. Earlier stages are
+ * added as well, so that the resources they use are counted in the job. The
+ * job is placed on CPUs and given priorities as set with place.
  *
- * Returns 0 if successful, 1 if not.
+ * notify, data and out_fd are as for background_command(). A client's job
+ * writes its output and stderr to out_fd rather than being captured, and so
+ * do the errors of starting it, so that the client sees them. If it cannot
+ * be started, notify is called with NULL.
  */
-int redirect_out(char *outfile) {
-    int newfd;
+void start_background(Command cmd, JobTable jobs, JobNotify notify,
+                      void *data, int out_fd) {
+    int stages = count_stages(cmd);
+    pid_t pids[stages];
+    char cmdline[JOB_CMD_LENGTH];
+    Capture capture = notify == NULL ? open_capture() : NULL;
+    int saved_out = -1, saved_err = -1;
+    int started;
 
-    // Open file to read from for stdin redirection.
-    newfd = open(outfile, O_CREAT | O_TRUNC | O_WRONLY, 0640);
-    if (newfd == -1) {
-        printf("cannot open %s for output\n", outfile);
-        return 1;
+    if (notify != NULL && out_fd != -1) {
+        fflush(stdout);
+        saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+        saved_err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+        dup2(out_fd, STDOUT_FILENO);
+        dup2(out_fd, STDERR_FILENO);
+    } else if (capture != NULL) {
+        out_fd = capture_fd(capture);
     }
 
-    // Redirect stdin to infile's fd.
-    newfd = dup2(newfd, STDOUT_FILENO);
-    if (newfd == -1) {
-        perror("dup2");
-        return 1;
+    next_placement();
+    started = start_pipeline(cmd, true, true, out_fd, pids);
+
+    if (notify != NULL && out_fd != -1) {
+        fflush(stdout);
+        restore_fd(saved_out, STDOUT_FILENO);
+        restore_fd(saved_err, STDERR_FILENO);
     }
 
-    return 0;
-}
+    if (started < stages) {
+        // Stages already started would be left without a reader or writer.
+        if (started > 0) {
+            kill(-pids[0], SIGTERM);
+        }
+        if (capture != NULL) {
+            discard_capture(capture);
+        }
+        if (notify != NULL) {
+            notify(NULL, data);
+        }
+        return;
+    }
 
-void free_command(Command cmd) {
-    for (int argc = 0; argc < cmd->argc; argc++) {
-        free(cmd->argv[argc]);
+    // Save job in table so that it may be terminated upon smallsh exit.
+    format_command(cmd, cmdline, sizeof(cmdline));
+    Process job = add_proc(jobs, pids[stages - 1], pids[0], cmdline);
+    for (int i = 0; i < stages - 1; i++) {
+        add_stage(jobs, pids[i], job);
     }
-    free(cmd->in_file);
-    free(cmd->out_file);
-    free(cmd);
+    if (cmd->time_limit > 0) {
+        set_deadline(jobs, job, cmd->time_limit, cmd->kill_grace);
+    }
+    if (capture != NULL) {
+        start_capture(capture, job->pid);
+        job->capture = capture;
+    }
+    if (notify != NULL) {
+        job->notify = notify;
+        job->notify_data = data;
+        return;
+    }
+
+    // Print the PID of the background process when it begins.
+    printf("background pid is %d\n", pids[stages - 1]);
+    fflush(stdout);
+}
+
+/**
+ * Writes the arguments of each stage of cmd into buf, separated by spaces,
+ * with stages separated by a vertical bar. Truncates the text to fit size
+ * bytes, including the terminating null byte.
+ */
+void format_command(Command cmd, char *buf, size_t size) {
+    size_t len = 0;
+
+    buf[0] = '\0';
+    for (Command stage = cmd; stage != NULL && len < size; stage = stage->next) {
+        if (stage != cmd) {
+            len += snprintf(buf + len, size - len, " |");
+        }
+        for (int i = 0; i < stage->argc && len < size; i++) {
+            len += snprintf(buf + len, size - len, len == 0 ? "%s" : " %s",
+                            stage->argv[i]);
+        }
+    }
+}
+
+/**
+ * Returns the number of commands in the pipeline cmd.
+ */
+int count_stages(Command cmd) {
+    int stages = 0;
+
+    for (; cmd != NULL; cmd = cmd->next) {
+        stages++;
+    }
+
+    return stages;
+}
+
+/**
+ * Starts every stage of the pipeline cmd, connecting the stdout of each stage
+ * to the stdin of the next through a pipe, and stores their pids in order in
+ * pids.
+ *
+ * Background pipelines read from and write to /dev/null unless redirected,
+ * and their stages share a new process group led by the first stage. If
+ * output_fd is not -1, every stage's stderr goes to it, and so does the
+ * output of the last stage in place of /dev/null.
+ * Foreground stages stay in smallsh's process group, which keeps them in the
+ * terminal's foreground so that Ctrl-c reaches every stage, unless own_group
+ * puts them in a new group as well, to be signalled as a whole.
+ *
+ * Stops at the first stage that cannot be started.
+ *
+ * Returns the number of stages started.
+ */
+int start_pipeline(Command cmd, bool is_bg, bool own_group, int output_fd,
+                   pid_t *pids) {
+    char *default_in = is_bg ? "/dev/null" : NULL;
+    char *default_out = is_bg && output_fd == -1 ? "/dev/null" : NULL;
+    pid_t pgid = is_bg || own_group ? 0 : -1;
+    int pipe_in = -1;
+    int started = 0;
+
+    for (Command stage = cmd; stage != NULL; stage = stage->next) {
+        int in_fd, out_fd;
+        int pipe_fds[2] = {-1, -1};
+        pid_t spawn_pid;
+
+        if (open_redirects(stage, stage == cmd ? default_in : NULL,
+                           stage->next == NULL ? default_out : NULL, &in_fd,
+                           &out_fd)) {
+            break;
+        }
+
+        if (stage->next != NULL) {
+            if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+                perror("pipe()");
+                close_redirects(in_fd, out_fd);
+                break;
+            }
+            if (pipe_size > 0) {
+                resize_pipe(pipe_fds[1], pipe_size);
+            }
+            out_fd = pipe_fds[1];
+        }
+
+        if (pipe_in != -1) {
+            in_fd = pipe_in;
+        }
+
+        spawn_pid = spawn_command(stage, in_fd,
+                                  out_fd != -1 ? out_fd : output_fd, output_fd,
+                                  pgid, is_bg);
+
+        // The children hold their own copies of the descriptors.
+        close_redirects(in_fd, out_fd);
+        pipe_in = pipe_fds[0];
+
+        if (spawn_pid == -1) {
+            break;
+        }
+
+        pids[started++] = spawn_pid;
+        if (pgid == 0) {
+            pgid = spawn_pid;
+        }
+    }
+
+    // Left open only if a later stage failed to start.
+    if (pipe_in != -1) {
+        close(pipe_in);
+    }
+
+    return started;
+}
+
+/**
+ * Sets the capacity of the pipe with file descriptor fd to at least size
+ * bytes.
+ *
+ * Returns the resulting capacity, or -1 if it could not be changed.
+ */
+int resize_pipe(int fd, int size) {
+    return fcntl(fd, F_SETPIPE_SZ, size);
+}
+
+/**
+ * Makes pgid the foreground process group of the terminal on smallsh's
+ * stdin. SIGTTOU is blocked meanwhile, since smallsh is itself in the
+ * background when it takes the terminal back.
+ *
+ * Returns whether the terminal was handed over.
+ */
+bool set_terminal(pid_t pgid) {
+    sigset_t ttou, saved;
+    bool done;
+
+    sigemptyset(&ttou);
+    sigaddset(&ttou, SIGTTOU);
+    sigprocmask(SIG_BLOCK, &ttou, &saved);
+    done = tcsetpgrp(STDIN_FILENO, pgid) == 0;
+    sigprocmask(SIG_SETMASK, &saved, NULL);
+
+    return done;
+}
+
+/**
+ * Starts cmd in a child process whose stdin, stdout and stderr are in_fd,
+ * out_fd and err_fd, or the shell's own when these are -1. The child joins
+ * process group pgid, or a new group of its own when pgid is 0, or stays in
+ * smallsh's when it is -1.
+ *
+ * Uses posix_spawn(), which glibc implements with clone(CLONE_VM |
+ * CLONE_VFORK), so the parent's address space is never copied. The program
+ * is located through the command location cache rather than a fresh $PATH
+ * search. The child's SIGINT is reset to its default for foreground commands
+ * and left ignored for background ones, and SIGTSTP is ignored by both. If
+ * posix_spawn is not supported, or smallsh was built with -DUSE_FORK, this
+ * falls back to fork_command(), as it does for background jobs while a
+ * placement is set (see placement.c).
+ *
+ * Prints any errors encountered.
+ *
+ * Returns the pid of the child, or -1 if it could not be started.
+ */
+pid_t spawn_command(Command cmd, int in_fd, int out_fd, int err_fd,
+                    pid_t pgid, bool is_bg) {
+    TRACE(TRACE_SPAWN, 0, 0);
+
+#ifdef USE_FORK
+    return fork_command(cmd, in_fd, out_fd, err_fd, pgid, is_bg);
+#else
+    // Only a forked child can place itself before it execs.
+    if (is_bg && placing()) {
+        return fork_command(cmd, in_fd, out_fd, err_fd, pgid, is_bg);
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t def_mask, child_mask;
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    char *path = NULL;
+    pid_t spawn_pid;
+    int result;
+
+    // Append a NULL to the array of args for the exec call.
+    cmd->argv[cmd->argc] = NULL;
+
+    posix_spawn_file_actions_init(&actions);
+    if (in_fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    }
+    if (out_fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    }
+    if (err_fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+    }
+
+    posix_spawnattr_init(&attr);
+    if (pgid != -1) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, pgid);
+    }
+#ifdef POSIX_SPAWN_USEVFORK
+    flags |= POSIX_SPAWN_USEVFORK;
+#endif
+    posix_spawnattr_setflags(&attr, flags);
+
+    // A foreground child may be interrupted, while the shell ignores SIGINT.
+    // SIGTSTP stays ignored, as the shell has no job control to resume a
+    // stopped child.
+    sigemptyset(&def_mask);
+    if (!is_bg) {
+        sigaddset(&def_mask, SIGINT);
+    }
+    posix_spawnattr_setsigdefault(&attr, &def_mask);
+
+    // smallsh blocks the signals it receives through a signalfd, which the
+    // child must not inherit.
+    sigemptyset(&child_mask);
+    posix_spawnattr_setsigmask(&attr, &child_mask);
+
+    result = ENOENT;
+    for (int attempt = 0; attempt < 2 && result == ENOENT; attempt++) {
+        path = hash_lookup(cmd->argv[0]);
+        if (path == NULL) {
+            break;
+        }
+
+        result = posix_spawn(&spawn_pid, path, &actions, &attr, cmd->argv,
+                             environ);
+
+        // The remembered file of a bare name is gone, so search $PATH once
+        // more. A name with a slash is the file itself and cannot move.
+        if (result != ENOENT || strchr(cmd->argv[0], '/') != NULL) {
+            break;
+        }
+        hash_forget(cmd->argv[0]);
+    }
+
+    // A file without a #! line is a script for /bin/sh, as execvp() has it.
+    if (result == ENOEXEC) {
+        char *sh_argv[cmd->argc + 2];
+
+        shell_args(cmd, path, sh_argv);
+        result = posix_spawn(&spawn_pid, sh_argv[0], &actions, &attr, sh_argv,
+                             environ);
+    }
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (result == ENOSYS) {
+        return fork_command(cmd, in_fd, out_fd, err_fd, pgid, is_bg);
+    }
+
+    if (result != 0) {
+        fprintf(stderr, "%s: %s\n", cmd->argv[0], strerror(result));
+        return -1;
+    }
+
+    // posix_spawn() returns once the child has exec'd the program.
+    TRACE(TRACE_EXEC, spawn_pid, 0);
+
+    return spawn_pid;
+#endif
+}
+
+/**
+ * Fills sh_argv, which has room for cmd->argc + 2 pointers, with the
+ * arguments that run the file at path with cmd's arguments as a /bin/sh
+ * script. This is how a program that exec() rejects with ENOEXEC is run.
+ */
+void shell_args(Command cmd, char *path, char **sh_argv) {
+    sh_argv[0] = "/bin/sh";
+    sh_argv[1] = path;
+    for (int i = 1; i <= cmd->argc; i++) {
+        sh_argv[i + 1] = cmd->argv[i];
+    }
+}
+
+/**
+ * Starts cmd in a child process created with fork().
+ *
+ * This is the fallback for spawn_command() and takes the same arguments.
+ *
+ * Returns the pid of the child, or -1 if it could not be started.
+ */
+pid_t fork_command(Command cmd, int in_fd, int out_fd, int err_fd,
+                   pid_t pgid, bool is_bg) {
+    pid_t spawn_pid;
+
+    // This switch statement idea is from Dr. Guillermo Tonsmann's
+    // "Processes" pdf, p.30.
+    switch (spawn_pid = fork()) {
+        case -1:
+            perror("fork() failed");
+            return -1;
+
+        case 0: // Child process.
+            if (pgid != -1) {
+                setpgid(0, pgid);
+            }
+
+            if (in_fd != -1 && dup2(in_fd, STDIN_FILENO) == -1) {
+                perror("dup2");
+                _exit(EXIT_FAILURE);
+            }
+
+            if (out_fd != -1 && dup2(out_fd, STDOUT_FILENO) == -1) {
+                perror("dup2");
+                _exit(EXIT_FAILURE);
+            }
+
+            if (err_fd != -1 && dup2(err_fd, STDERR_FILENO) == -1) {
+                perror("dup2");
+                _exit(EXIT_FAILURE);
+            }
+
+            // A background job runs on its CPUs and at its priority from
+            // the start.
+            if (is_bg) {
+                apply_placement();
+            }
+
+            // Append a NULL to the array of args for the execvp call.
+            cmd->argv[cmd->argc] = NULL;
+
+            struct sigaction SIGINT_action = {0};
+            struct sigaction SIGTSTP_action = {0};
+            sigset_t child_mask;
+
+            // Unblock the signals that smallsh reads through a signalfd.
+            sigemptyset(&child_mask);
+            sigprocmask(SIG_SETMASK, &child_mask, NULL);
+
+            /* These lines are adapted from "Exploration: Signal Handling API".
+             * https://canvas.oregonstate.edu/courses/1987883/pages/exploration-signal-handling-api?module_item_id=24956227
+             * 2025-02-18
+             */
+            if (is_bg) {
+                // Background processes ignore SIGINT.
+                SIGINT_action.sa_handler = SIG_IGN;
+            } else {
+                // Register handler for SIGINT.
+                // This will not apply to exec() commands.
+                SIGINT_action.sa_handler = handle_fg_SIGINT;
+                // Block catchable signals while SIGINT is running.
+                sigfillset(&SIGINT_action.sa_mask);
+            }
+            // No flags.
+            SIGINT_action.sa_flags = 0;
+            // Install the handler.
+            sigaction(SIGINT, &SIGINT_action, NULL);
+
+            // Register handler to ignore SIGTSTP.
+            // This will apply to exec() commands.
+            SIGTSTP_action.sa_handler = SIG_IGN;
+            // Install the handler.
+            sigaction(SIGTSTP, &SIGTSTP_action, NULL);
+
+            // The child process executes the command as spawn_command()
+            // does: $PATH is searched again only if the remembered file of a
+            // bare name is gone, and a file without a #! line is run by
+            // /bin/sh.
+            int error = ENOENT;
+            for (int attempt = 0; attempt < 2 && error == ENOENT; attempt++) {
+                char *path = hash_lookup(cmd->argv[0]);
+                if (path == NULL) {
+                    break;
+                }
+
+                execve(path, cmd->argv, environ);
+                error = errno;
+
+                if (error == ENOEXEC) {
+                    char *sh_argv[cmd->argc + 2];
+
+                    shell_args(cmd, path, sh_argv);
+                    execve(sh_argv[0], sh_argv, environ);
+                    error = errno;
+                    break;
+                }
+                if (strchr(cmd->argv[0], '/') != NULL) {
+                    break;
+                }
+                hash_forget(cmd->argv[0]);
+            }
+
+            fprintf(stderr, "%s: %s\n", cmd->argv[0], strerror(error));
+            _exit(EXIT_FAILURE);
+            // parent process takes care of updating status
+
+            break;
+
+        default:
+            TRACE(TRACE_EXEC, spawn_pid, 0);
+
+            // Also set the group here, in case the child has not done so
+            // before the next stage joins it.
+            if (pgid != -1) {
+                setpgid(spawn_pid, pgid == 0 ? spawn_pid : pgid);
+            }
+            break;
+    }
+
+    return spawn_pid;
+}
+
+/**
+ * Opens the files named by cmd's i/o redirections, storing their descriptors
+ * in in_fd and out_fd. A missing redirection uses default_in or default_out
+ * if it is not NULL, else its descriptor is -1.
+ *
+ * The descriptors are close-on-exec; the child receives them by dup2().
+ *
+ * This function prints any errors encountered.
+ *
+ * Returns 0 if successful, 1 if not.
+ */
+int open_redirects(Command cmd, char *default_in, char *default_out,
+                   int *in_fd, int *out_fd) {
+    char *infile = cmd->in_file != NULL ? cmd->in_file : default_in;
+    char *outfile = cmd->out_file != NULL ? cmd->out_file : default_out;
+
+    *in_fd = -1;
+    *out_fd = -1;
+
+    if (infile != NULL) {
+        *in_fd = open(infile, O_RDONLY | O_CLOEXEC);
+        if (*in_fd == -1) {
+            printf("cannot open %s for input\n", infile);
+            fflush(stdout);
+            return 1;
+        }
+    }
+
+    if (outfile != NULL) {
+        *out_fd = open(outfile, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC,
+                       0640);
+        if (*out_fd == -1) {
+            printf("cannot open %s for output\n", outfile);
+            fflush(stdout);
+            close_redirects(*in_fd, -1);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Closes the parent's copies of descriptors opened by open_redirects().
+ */
+void close_redirects(int in_fd, int out_fd) {
+    if (in_fd != -1) {
+        close(in_fd);
+    }
+    if (out_fd != -1) {
+        close(out_fd);
+    }
+}
+
+/**
+ * Redirects stdin file descriptor to the specified pathname.
+ *
+ * This function prints any errors encountered.
+ *
+ * Returns 0 if successful, 1 if not.
+ */
+int redirect_in(char *infile) {
+    int newfd;
+
+    // Open file to read from for stdin redirection.
+    newfd = open(infile, O_RDONLY);
+    if (newfd == -1) {
+        printf("cannot open %s for input\n", infile);
+        return 1;
+    }
+
+    // Redirect stdin to infile's fd.
+    if (dup2(newfd, STDIN_FILENO) == -1) {
+        perror("dup2");
+        close(newfd);
+        return 1;
+    }
+    close(newfd);
+
+    return 0;
+}
+
+/**
+ * Redirects stdout file descriptor to the specified pathname.
+ *
+ * This function prints any errors encountered.
+ *
+ * Returns 0 if successful, 1 if not.
+ */
+int redirect_out(char *outfile) {
+    int newfd;
+
+    // Open file to read from for stdin redirection.
+    newfd = open(outfile, O_CREAT | O_TRUNC | O_WRONLY, 0640);
+    if (newfd == -1) {
+        printf("cannot open %s for output\n", outfile);
+        return 1;
+    }
+
+    // Redirect stdout to outfile's fd.
+    if (dup2(newfd, STDOUT_FILENO) == -1) {
+        perror("dup2");
+        close(newfd);
+        return 1;
+    }
+    close(newfd);
+
+    return 0;
+}
+
+/**
+ * Appends arg to the arguments of cmd, growing argv within arena so that it
+ * always has room for a terminating NULL.
+ */
+void add_arg(Arena arena, Command cmd, char *arg) {
+    if (cmd->argc + 1 == cmd->arg_capacity) {
+        grow_args(arena, cmd);
+    }
+
+    // cmd->argc tracks the cmd->argv subscript for the current argument,
+    // incrementing so that it reflects the total number of arguments stored.
+    cmd->argv[cmd->argc++] = arg;
+}
+
+/**
+ * Copies the pipeline cmd, all of its stages and strings but not the rest of
+ * its command list, into a single block of heap memory, so that it outlives
+ * the arena and line it was parsed from.
+ *
+ * Returns the copy, which is released with free().
+ */
+Command copy_command(Command cmd) {
+    size_t fixed = 0, text_size = 0;
+    char *block, *next, *text;
+    Command copy = NULL, *link = &copy;
+
+    // Measure the stages and their argv arrays, then their strings.
+    for (Command stage = cmd; stage != NULL; stage = stage->next) {
+        fixed += sizeof(struct command_entry);
+        fixed += (stage->argc + 1) * sizeof(char *);
+        for (int i = 0; i < stage->argc; i++) {
+            text_size += strlen(stage->argv[i]) + 1;
+        }
+        text_size += stage->in_file != NULL ? strlen(stage->in_file) + 1 : 0;
+        text_size += stage->out_file != NULL ? strlen(stage->out_file) + 1 : 0;
+    }
+
+    // The stages and argv arrays come first, keeping pointers aligned, and
+    // the strings follow.
+    block = malloc(fixed + text_size);
+    next = block;
+    text = block + fixed;
+
+    for (Command stage = cmd; stage != NULL; stage = stage->next) {
+        Command dup = (Command)next;
+
+        *dup = *stage;
+        next += sizeof(struct command_entry);
+        dup->argv = (char **)next;
+        dup->arg_capacity = stage->argc + 1;
+        next += dup->arg_capacity * sizeof(char *);
+
+        for (int i = 0; i < stage->argc; i++) {
+            dup->argv[i] = copy_string(&text, stage->argv[i]);
+        }
+        dup->argv[stage->argc] = NULL;
+
+        if (stage->in_file != NULL) {
+            dup->in_file = copy_string(&text, stage->in_file);
+        }
+        if (stage->out_file != NULL) {
+            dup->out_file = copy_string(&text, stage->out_file);
+        }
+
+        dup->next = NULL;
+        dup->next_list = NULL;
+        *link = dup;
+        link = &dup->next;
+    }
+
+    return copy;
+}
+
+/**
+ * Appends the command list cmd to the compiled script in buf as a struct
+ * compiled_stage for each stage of each of its pipelines, or, if cmd is NULL,
+ * the parse error error. line is the line of the script it came from. The &
+ * is recorded as written, whether or not foreground-only mode is on.
+ *
+ * Returns the offset of the first stage.
+ */
+uint32_t compile_command(struct script_buffer *buf, Command cmd, char *error,
+                         uint32_t line) {
+    struct compiled_stage record;
+    uint32_t first = 0, previous = 0;
+
+    if (cmd == NULL) {
+        memset(&record, 0, sizeof(record));
+        record.line = line;
+        record.error = script_string(buf, error);
+        return script_append(buf, &record, sizeof(record), 8);
+    }
+
+    first = compile_pipeline(buf, cmd, line);
+    previous = first;
+    for (cmd = cmd->next_list; cmd != NULL; cmd = cmd->next_list) {
+        uint32_t offset = compile_pipeline(buf, cmd, line);
+
+        ((struct compiled_stage *)(buf->data + previous))->next_list = offset;
+        previous = offset;
+    }
+
+    return first;
+}
+
+/**
+ * Appends the pipeline cmd to the compiled script in buf as a struct
+ * compiled_stage for each of its stages, as compile_command() does.
+ *
+ * Returns the offset of the first stage.
+ */
+uint32_t compile_pipeline(struct script_buffer *buf, Command cmd,
+                          uint32_t line) {
+    struct compiled_stage record;
+    uint32_t first = 0, previous = 0;
+
+    for (Command stage = cmd; stage != NULL; stage = stage->next) {
+        uint32_t argv[stage->argc + 1], offset;
+        int nvars = 0;
+
+        memset(&record, 0, sizeof(record));
+        record.line = line;
+        record.argc = stage->argc;
+        for (int i = 0; i < stage->argc; i++) {
+            argv[i] = script_string(buf, stage->argv[i]);
+        }
+        record.argv = script_append(buf, argv, stage->argc * sizeof(uint32_t),
+                                    sizeof(uint32_t));
+        if (stage->in_file != NULL) {
+            record.in_file = script_string(buf, stage->in_file);
+        }
+        if (stage->out_file != NULL) {
+            record.out_file = script_string(buf, stage->out_file);
+        }
+
+        for (struct memo_var *var = stage->memo_vars; var != NULL;
+             var = var->next) {
+            nvars++;
+        }
+        if (nvars > 0) {
+            uint32_t vars[nvars + 1];
+            int i = 0;
+
+            for (struct memo_var *var = stage->memo_vars; var != NULL;
+                 var = var->next) {
+                vars[i++] = script_string(buf, var->name);
+            }
+            vars[i] = 0;
+            record.memo_vars = script_append(buf, vars, sizeof(vars),
+                                             sizeof(uint32_t));
+        }
+
+        record.is_bg = stage->is_bg;
+        record.is_timed = stage->is_timed;
+        record.is_memo = stage->is_memo;
+        record.has_patterns = stage->has_patterns;
+        record.list_op = stage->list_op;
+        record.time_limit = stage->time_limit;
+        record.kill_grace = stage->kill_grace;
+
+        // The previous stage is linked to this one once its offset is known.
+        offset = script_append(buf, &record, sizeof(record), 8);
+        if (previous != 0) {
+            ((struct compiled_stage *)(buf->data + previous))->next = offset;
+        } else {
+            first = offset;
+        }
+        previous = offset;
+    }
+
+    return first;
+}
+
+/**
+ * Returns whether a string starting at offset, and its terminator, lie within
+ * the size bytes of the compiled script base.
+ */
+bool check_string(char *base, size_t size, uint32_t offset) {
+    return offset != 0 && offset < size &&
+           memchr(base + offset, '\0', size - offset) != NULL;
+}
+
+/**
+ * Returns whether every record of the command list whose first stage is at
+ * offset in the compiled script base, and every offset and count in them,
+ * lie within the script's size bytes, so that load_command() reads nothing
+ * outside them. Stages follow the stages before them, as compile_command()
+ * writes them, which also keeps a damaged chain from looping.
+ */
+bool check_command(char *base, size_t size, uint32_t offset) {
+    uint32_t list = offset;
+
+    while (list != 0) {
+        for (offset = list; offset != 0;) {
+            struct compiled_stage *record;
+            uint32_t *argv;
+
+            if (offset % 8 != 0 ||
+                (uint64_t)offset + sizeof(struct compiled_stage) > size) {
+                return false;
+            }
+            record = (struct compiled_stage *)(base + offset);
+
+            // load_command() reads nothing past a parse error's message,
+            // which it looks for in the first stage of each pipeline.
+            if (offset == list && record->error != 0) {
+                return check_string(base, size, record->error);
+            }
+
+            // A parsed stage always names a command.
+            if (record->argc == 0 || record->argv % sizeof(uint32_t) != 0 ||
+                (uint64_t)record->argv + record->argc * sizeof(uint32_t) >
+                    size) {
+                return false;
+            }
+            argv = (uint32_t *)(base + record->argv);
+            for (uint32_t i = 0; i < record->argc; i++) {
+                if (!check_string(base, size, argv[i])) {
+                    return false;
+                }
+            }
+            if ((record->in_file != 0 &&
+                 !check_string(base, size, record->in_file)) ||
+                (record->out_file != 0 &&
+                 !check_string(base, size, record->out_file))) {
+                return false;
+            }
+            if (record->memo_vars != 0) {
+                uint32_t var = record->memo_vars;
+
+                if (var % sizeof(uint32_t) != 0) {
+                    return false;
+                }
+                for (;; var += sizeof(uint32_t)) {
+                    uint32_t name;
+
+                    if ((uint64_t)var + sizeof(uint32_t) > size) {
+                        return false;
+                    }
+                    name = *(uint32_t *)(base + var);
+                    if (name == 0) {
+                        break;
+                    }
+                    if (!check_string(base, size, name)) {
+                        return false;
+                    }
+                }
+            }
+
+            if (record->next != 0 && record->next <= offset) {
+                return false;
+            }
+            offset = record->next;
+        }
+
+        offset = ((struct compiled_stage *)(base + list))->next_list;
+        if (offset != 0 && offset <= list) {
+            return false;
+        }
+        list = offset;
+    }
+
+    return true;
+}
+
+/**
+ * Rebuilds the command list whose first stage is at offset in the compiled
+ * script base, allocating its stages and argv arrays from arena. Its strings
+ * point into base. As in parse_line(), the & is ignored if fg_only, and a
+ * line that failed to parse gives NULL with its message stored in error.
+ */
+Command load_command(Arena arena, char *base, uint32_t offset, int fg_only,
+                     char **error) {
+    Command cmd = NULL, *link = &cmd;
+
+    *error = NULL;
+    while (offset != 0) {
+        struct compiled_stage *record =
+            (struct compiled_stage *)(base + offset);
+
+        if (record->error != 0) {
+            *error = base + record->error;
+            return NULL;
+        }
+
+        *link = load_pipeline(arena, base, offset, fg_only);
+        link = &(*link)->next_list;
+        offset = record->next_list;
+    }
+
+    return cmd;
+}
+
+/**
+ * Rebuilds the pipeline whose first stage is at offset in the compiled script
+ * base, as load_command() does.
+ */
+Command load_pipeline(Arena arena, char *base, uint32_t offset, int fg_only) {
+    Command cmd = NULL, *link = &cmd;
+
+    while (offset != 0) {
+        struct compiled_stage *record =
+            (struct compiled_stage *)(base + offset);
+        uint32_t *argv = (uint32_t *)(base + record->argv);
+        Command stage = new_stage(arena);
+
+        for (uint32_t i = 0; i < record->argc; i++) {
+            add_arg(arena, stage, base + argv[i]);
+        }
+        if (record->in_file != 0) {
+            stage->in_file = base + record->in_file;
+        }
+        if (record->out_file != 0) {
+            stage->out_file = base + record->out_file;
+        }
+        if (record->memo_vars != 0) {
+            struct memo_var **var_link = &stage->memo_vars;
+
+            // Kept in the same order as parse_line() leaves them.
+            for (uint32_t *var = (uint32_t *)(base + record->memo_vars);
+                 *var != 0; var++) {
+                *var_link = arena_alloc(arena, sizeof(struct memo_var));
+                (*var_link)->name = base + *var;
+                (*var_link)->next = NULL;
+                var_link = &(*var_link)->next;
+            }
+        }
+
+        stage->is_bg = record->is_bg && !fg_only;
+        stage->is_timed = record->is_timed;
+        stage->is_memo = record->is_memo;
+        stage->has_patterns = record->has_patterns;
+        stage->list_op = record->list_op;
+        stage->time_limit = record->time_limit;
+        stage->kill_grace = record->kill_grace;
+
+        *link = stage;
+        link = &stage->next;
+        offset = record->next;
+    }
+
+    return cmd;
+}
+
+/**
+ * Copies str to *dest, advancing *dest past the copy's terminator.
+ *
+ * Returns the copy.
+ */
+char *copy_string(char **dest, char *str) {
+    char *copy = *dest;
+    size_t size = strlen(str) + 1;
+
+    memcpy(copy, str, size);
+    *dest += size;
+
+    return copy;
+}
+
+/**
+ * Replaces each pattern among the arguments of the stages of the pipeline
+ * cmd with the names of the files it matches, allocated from arena. A
+ * pattern that matches nothing is kept as it is.
+ */
+void expand_wildcards(Arena arena, Command cmd) {
+    for (Command stage = cmd; stage != NULL; stage = stage->next) {
+        Command expanded;
+
+        if (!stage->has_patterns) {
+            continue;
+        }
+
+        expanded = new_stage(arena);
+        for (int i = 0; i < stage->argc; i++) {
+            if (strpbrk(stage->argv[i], TOKEN_WILDCARDS) == NULL ||
+                expand_pattern(arena, stage->argv[i], expanded) == 0) {
+                add_arg(arena, expanded, stage->argv[i]);
+            }
+        }
+
+        stage->argv = expanded->argv;
+        stage->argc = expanded->argc;
+        stage->arg_capacity = expanded->arg_capacity;
+        stage->argv[stage->argc] = NULL;
+        stage->has_patterns = false;
+    }
+}
+
+/**
+ * Doubles the room for arguments in cmd's argv.
+ */
+void grow_args(Arena arena, Command cmd) {
+    char **argv = arena_alloc(arena, 2 * cmd->arg_capacity * sizeof(char *));
+
+    memcpy(argv, cmd->argv, cmd->argc * sizeof(char *));
+    cmd->argv = argv;
+    cmd->arg_capacity *= 2;
+}
+
+/**
+ * Allocates an empty command from arena.
+ */
+Command new_stage(Arena arena) {
+    Command cmd = arena_alloc(arena, sizeof(struct command_entry));
+
+    memset(cmd, 0, sizeof(struct command_entry));
+    cmd->arg_capacity = INITIAL_ARGS;
+    cmd->argv = arena_alloc(arena, cmd->arg_capacity * sizeof(char *));
+
+    return cmd;
 }
@@ -1,15 +1,21 @@
 #ifndef COMMANDS_H
 #define COMMANDS_H
 
+#include "arena.h"
 #include "processes.h"
+#include "script.h"
+#include "sha256.h"
 #include <stdbool.h>
 
-// Suggested directives from sample_parser.c
-#define INPUT_LENGTH 2048
-#define MAX_ARGS 512
+// Number of arguments a command has room for before its argv grows.
+#define INITIAL_ARGS 16
 
 #define PROMPT ": "
 
+// Seconds a command is given to exit after SIGTERM for exceeding its limit
+// before it is sent SIGKILL, unless limit -k says otherwise.
+#define LIMIT_GRACE 5
+
 // Incomplete type to encapsulate its data structure.
 // The struct is implemented in commands.c.
 struct command_entry;
@@ -17,13 +23,58 @@ struct command_entry;
 // Client code interfaces with the command_entry struct through its pointer.
 typedef struct command_entry *Command;
 
-Process background_command(Command cmd, Process procs);
-void free_command(Command cmd);
-Command parse_command(int fg_only);
+// Declared in builtins.h.
+struct builtin;
+
+void add_arg(Arena arena, Command cmd, char *arg);
+void background_command(Command cmd, JobTable jobs, JobNotify notify,
+                        void *data, int out_fd);
+bool check_command(char *base, size_t size, uint32_t offset);
+bool check_string(char *base, size_t size, uint32_t offset);
+char *client_command(Command cmd, JobTable jobs, JobNotify notify, void *data,
+                     int out_fd);
+void close_redirects(int in_fd, int out_fd);
+uint32_t compile_command(struct script_buffer *buf, Command cmd, char *error,
+                         uint32_t line);
+uint32_t compile_pipeline(struct script_buffer *buf, Command cmd,
+                          uint32_t line);
+Command copy_command(Command cmd);
+char *copy_string(char **dest, char *str);
+int count_stages(Command cmd);
+pid_t fork_command(Command cmd, int in_fd, int out_fd, int err_fd,
+                   pid_t pgid, bool is_bg);
+void format_command(Command cmd, char *buf, size_t size);
+int open_redirects(Command cmd, char *default_in, char *default_out,
+                   int *in_fd, int *out_fd);
+void grow_args(Arena arena, Command cmd);
+Command load_command(Arena arena, char *base, uint32_t offset, int fg_only,
+                     char **error);
+Command load_pipeline(Arena arena, char *base, uint32_t offset, int fg_only);
+void memo_command(Command cmd, JobTable jobs);
+void memo_key(Command cmd, unsigned char key[SHA256_SIZE]);
+void memo_key_file(struct sha256 *ctx, char *path);
+Command new_stage(Arena arena);
+Command parse_command(Arena arena, char *input, int fg_only);
+void parse_error(char *error);
+Command parse_line(Arena arena, char *input, int fg_only, char **error_out);
 int print_command(Command cmd);
-Process process_command(Command cmd, Process procs);
+bool reads_stdin(Command cmd);
+void process_command(Arena arena, Command cmd, JobTable jobs);
 int redirect_in(char *infile);
+int resize_pipe(int fd, int size);
 int redirect_out(char *outfile);
-void execute_command(Command cmd);
+void restore_fd(int saved_fd, int fd);
+void run_builtin(struct builtin *builtin, Command cmd, JobTable jobs);
+void run_pipeline(Command cmd, JobTable jobs);
+bool set_terminal(pid_t pgid);
+void shell_args(Command cmd, char *path, char **sh_argv);
+int execute_command(Command cmd, JobTable jobs);
+void expand_wildcards(Arena arena, Command cmd);
+pid_t spawn_command(Command cmd, int in_fd, int out_fd, int err_fd,
+                    pid_t pgid, bool is_bg);
+void start_background(Command cmd, JobTable jobs, JobNotify notify,
+                      void *data, int out_fd);
+int start_pipeline(Command cmd, bool is_bg, bool own_group, int output_fd,
+                   pid_t *pids);
 
 #endif
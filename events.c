@@ -0,0 +1,330 @@
+/**
+ * The event loop that smallsh waits in between commands.
+ *
+ * An epoll instance watches the input for lines and a signalfd for the
+ * signals the shell acts on: SIGCHLD when a background job may have
+ * finished, SIGTSTP to toggle foreground-only mode and SIGINT to abandon the
+ * line being entered, plus any added with watch_signal(). These signals are
+ * blocked, so they are only ever handled between commands, by the loop,
+ * rather than interrupting the shell wherever it happens to be.
+ *
+ * SIGINT and SIGTSTP are also ignored, which children inherit, except that
+ * foreground commands have SIGINT restored to its default. A blocked signal
+ * is still queued for the signalfd although it is ignored.
+ *
+ * Some descriptors must be serviced even while the shell is busy with a
+ * command, such as the timerfd of job deadlines and the pipes capturing
+ * background output. These are added with add_busy_event(), and besides the
+ * loop, wait_signal() watches them, so they are serviced wherever the shell
+ * waits.
+ */
+
+#define _GNU_SOURCE
+#include "events.h"
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// A descriptor watched by the event loop, and by wait_signal() too if busy.
+struct event_source {
+    int fd;
+    EventHandler handler;
+    void *data;
+    bool busy;
+};
+
+// Readable when a signal the shell acts on has arrived, or -1 before
+// open_events().
+int signal_fd = -1;
+
+// The signals read through signal_fd.
+sigset_t signal_mask;
+
+// The epoll instance, and the descriptors it watches.
+int epoll_fd = -1;
+struct event_source sources[MAX_EVENT_SOURCES];
+
+// Signals read from signal_fd but not yet taken, as a bit per signal.
+uint64_t pending_signals = 0;
+
+void signals_ready(int fd, void *data);
+
+/**
+ * Watches fd, calling handler with data from run_events() whenever it is
+ * readable. Returns -1 if fd cannot be watched, with errno set to EPERM for a
+ * regular file, which is always ready.
+ */
+int add_event(int fd, EventHandler handler, void *data) {
+    struct epoll_event event = {EPOLLIN};
+
+    for (int i = 0; i < MAX_EVENT_SOURCES; i++) {
+        if (sources[i].handler != NULL) {
+            continue;
+        }
+
+        event.data.ptr = &sources[i];
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            return -1;
+        }
+        sources[i].fd = fd;
+        sources[i].handler = handler;
+        sources[i].data = data;
+        sources[i].busy = false;
+        return 0;
+    }
+
+    errno = ENOSPC;
+    return -1;
+}
+
+/**
+ * Watches fd like add_event(), and also while wait_signal() waits, so that
+ * handler is called with data soon after fd is readable even during a
+ * command.
+ */
+int add_busy_event(int fd, EventHandler handler, void *data) {
+    if (add_event(fd, handler, data) == -1) {
+        return -1;
+    }
+
+    for (int i = 0; i < MAX_EVENT_SOURCES; i++) {
+        if (sources[i].handler != NULL && sources[i].fd == fd) {
+            sources[i].busy = true;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Notes signo as having arrived, for a caller that took it while the rest of
+ * the shell must still see it.
+ */
+void keep_signal(int signo) {
+    pending_signals |= 1ULL << signo;
+}
+
+/**
+ * Creates the event loop, blocking the signals it reads through its
+ * signalfd. Returns -1 if it could not be created.
+ */
+int open_events(void) {
+    struct sigaction ign_action = {0};
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("epoll_create1()");
+        return -1;
+    }
+
+    ign_action.sa_handler = SIG_IGN;
+    sigaction(SIGINT, &ign_action, NULL);
+    sigaction(SIGTSTP, &ign_action, NULL);
+
+    sigemptyset(&signal_mask);
+    sigaddset(&signal_mask, SIGCHLD);
+    sigaddset(&signal_mask, SIGINT);
+    sigaddset(&signal_mask, SIGTSTP);
+    sigprocmask(SIG_BLOCK, &signal_mask, NULL);
+
+    signal_fd = signalfd(-1, &signal_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1) {
+        perror("signalfd()");
+        return -1;
+    }
+
+    return add_event(signal_fd, signals_ready, NULL);
+}
+
+/**
+ * Reads the signals that have arrived, without waiting, so that they can be
+ * taken with take_signal(). Each signal is noted once however many times it
+ * arrived.
+ */
+void read_signals(void) {
+    struct signalfd_siginfo info;
+
+    if (signal_fd == -1) {
+        return;
+    }
+
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        pending_signals |= 1ULL << info.ssi_signo;
+    }
+}
+
+/**
+ * Stops watching fd.
+ */
+void remove_event(int fd) {
+    for (int i = 0; i < MAX_EVENT_SOURCES; i++) {
+        if (sources[i].handler != NULL && sources[i].fd == fd) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            sources[i].handler = NULL;
+            return;
+        }
+    }
+}
+
+/**
+ * Waits up to timeout milliseconds, or without limit if timeout is -1, for
+ * watched descriptors to become readable, and calls their handlers. Returns
+ * the number of handlers called.
+ */
+int run_events(int timeout) {
+    struct epoll_event events[MAX_EVENT_SOURCES];
+    int ready;
+
+    do {
+        ready = epoll_wait(epoll_fd, events, MAX_EVENT_SOURCES, timeout);
+    } while (ready == -1 && errno == EINTR);
+
+    if (ready == -1) {
+        perror("epoll_wait()");
+        return 0;
+    }
+
+    for (int i = 0; i < ready; i++) {
+        struct event_source *source = events[i].data.ptr;
+
+        source->handler(source->fd, source->data);
+    }
+
+    return ready;
+}
+
+/**
+ * Handles the signalfd becoming readable.
+ */
+void signals_ready(int fd, void *data) {
+    read_signals();
+}
+
+/**
+ * Returns whether signo has arrived since it was last taken, and forgets it.
+ * read_signals() or run_events() must have read it first.
+ */
+bool take_signal(int signo) {
+    bool pending = (pending_signals & (1ULL << signo)) != 0;
+
+    pending_signals &= ~(1ULL << signo);
+    return pending;
+}
+
+/**
+ * Reads signo through the signalfd too, blocking it, so that it can be
+ * taken with take_signal() rather than having its default action. Returns -1
+ * if it cannot be.
+ */
+int watch_signal(int signo) {
+    sigaddset(&signal_mask, signo);
+    sigprocmask(SIG_BLOCK, &signal_mask, NULL);
+
+    if (signalfd(signal_fd, &signal_mask, 0) == -1) {
+        perror("signalfd()");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Waits until signo arrives, or for timeout if that is not NULL, and takes
+ * it, as wait_signals() does. Returns whether signo arrived.
+ */
+bool wait_signal(int signo, struct timespec *timeout) {
+    return wait_signals(signo, signo, timeout) != 0;
+}
+
+/**
+ * Waits until first or second arrives, or for timeout if that is not NULL,
+ * and takes the one that did, first if both have. Other signals that arrive
+ * meanwhile, and second if both have, are kept for later, while sources
+ * added by add_busy_event() are handled as they become ready.
+ *
+ * Returns the signal taken, or 0 if neither arrived.
+ */
+int wait_signals(int first, int second, struct timespec *timeout) {
+    struct pollfd fds[MAX_EVENT_SOURCES + 1];
+    struct event_source *busy[MAX_EVENT_SOURCES];
+    struct timespec now, deadline, remaining;
+    int nbusy;
+
+    if (signal_fd == -1) {
+        // Without a signalfd, only a child can be waited for.
+        if (first == SIGCHLD || second == SIGCHLD) {
+            siginfo_t child;
+            return waitid(P_ALL, 0, &child, WEXITED | WNOWAIT) == 0 ? SIGCHLD
+                                                                    : 0;
+        }
+        if (timeout != NULL) {
+            nanosleep(timeout, NULL);
+        }
+        return 0;
+    }
+
+    // A wait too long to represent has no limit.
+    if (timeout != NULL && timeout->tv_sec > INT32_MAX) {
+        timeout = NULL;
+    }
+
+    if (timeout != NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout->tv_sec;
+        deadline.tv_nsec += timeout->tv_nsec;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    while (true) {
+        read_signals();
+        if (take_signal(first)) {
+            return first;
+        }
+        if (take_signal(second)) {
+            return second;
+        }
+
+        if (timeout != NULL) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+            remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (remaining.tv_nsec < 0) {
+                remaining.tv_sec--;
+                remaining.tv_nsec += 1000000000;
+            }
+            if (remaining.tv_sec < 0) {
+                return 0;
+            }
+        }
+
+        // Handlers may add or remove sources, so gather them each time.
+        fds[0] = (struct pollfd){signal_fd, POLLIN, 0};
+        nbusy = 0;
+        for (int i = 0; i < MAX_EVENT_SOURCES; i++) {
+            if (sources[i].handler != NULL && sources[i].busy) {
+                busy[nbusy] = &sources[i];
+                fds[++nbusy] = (struct pollfd){sources[i].fd, POLLIN, 0};
+            }
+        }
+
+        if (ppoll(fds, nbusy + 1, timeout != NULL ? &remaining : NULL,
+                  NULL) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("ppoll()");
+            return 0;
+        }
+        for (int i = 0; i < nbusy; i++) {
+            if ((fds[i + 1].revents & POLLIN) && busy[i]->handler != NULL) {
+                busy[i]->handler(busy[i]->fd, busy[i]->data);
+            }
+        }
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdbool.h>
+#include <time.h>
+
+// Most descriptors the event loop watches at once.
+#define MAX_EVENT_SOURCES 16
+
+// Called by run_events() when fd is ready to be read.
+typedef void (*EventHandler)(int fd, void *data);
+
+extern int signal_fd;
+
+int add_event(int fd, EventHandler handler, void *data);
+int add_busy_event(int fd, EventHandler handler, void *data);
+void keep_signal(int signo);
+int open_events(void);
+void read_signals(void);
+void remove_event(int fd);
+int run_events(int timeout);
+bool take_signal(int signo);
+bool wait_signal(int signo, struct timespec *timeout);
+int wait_signals(int first, int second, struct timespec *timeout);
+int watch_signal(int signo);
+
+#endif
@@ -0,0 +1,677 @@
+/**
+ * Command history, kept in a file that every interactive smallsh appends
+ * the lines it reads to, shown and searched by prefix with the history
+ * built-in, and recalled with !.
+ *
+ * Usage:
+ *  history             show the whole history
+ *  history N           show the last N entries
+ *  history -p PREFIX   show the distinct entries starting with PREFIX, each
+ *                      where it was last used, oldest first; the words of
+ *                      PREFIX are joined with single spaces
+ *
+ * A line whose first word is !! runs the last entry again, and one whose
+ * first word is !prefix the latest entry starting with prefix, followed in
+ * both cases by the rest of the line.
+ *
+ * The history file is $SMALLSH_HISTORY, else ~/.smallsh_history. Each line
+ * is written with a single write() to the file opened with O_APPEND, so the
+ * lines of shells running at once interleave whole. Nothing is read at
+ * startup: the file is mapped when first searched, and mapped again only
+ * once it has grown, with just the new lines scanned. A last line without
+ * its newline is still being written and is left for later.
+ *
+ * Searches go through an index kept beside the history, in the file of the
+ * same name plus .idx: the offsets of the distinct entries, each at its
+ * latest use, sorted by text, so that those starting with a prefix are found
+ * by binary search. The index covers the history up to some length, and the
+ * entries after that are searched one by one until there are more than
+ * HISTORY_RECENT_MAX of them, when they are merged into a new index. That is
+ * written under a temporary name and renamed into place, so the index of a
+ * long history is built once and from then on only merged with what is new.
+ * Offsets are 32 bits, so only the first 4 GiB of history are searched.
+ */
+
+#define _GNU_SOURCE
+#include "history.h"
+#include "builtins.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * The history file and what is known of it.
+ *
+ * Fields:
+ * path : the history file
+ * fd : the history file, opened to append, or -1 before it is opened
+ * failed : whether it could not be opened or history is off
+ * base : the history file, mapped, or NULL
+ * mapped : number of bytes mapped at base
+ * size : number of bytes at base up to the end of the last whole line
+ * index : offsets of the indexed entries, sorted by text
+ * count : number of entries in index
+ * covered : number of bytes of the history that index covers
+ * index_map, index_map_size : the index file mapped, if index points into
+ *      it rather than to memory of its own
+ * index_loaded : whether the index file has been looked for
+ * recent : offsets of the entries after covered, oldest first
+ * recent_count : number of entries in recent
+ * recent_capacity : number of entries recent has room for
+ * scanned : number of bytes of the history whose entries are in index or
+ *      recent
+ */
+struct history {
+    char path[PATH_MAX];
+    int fd;
+    bool failed;
+    char *base;
+    size_t mapped;
+    size_t size;
+    uint32_t *index;
+    uint32_t count;
+    size_t covered;
+    char *index_map;
+    size_t index_map_size;
+    bool index_loaded;
+    uint32_t *recent;
+    size_t recent_count;
+    size_t recent_capacity;
+    size_t scanned;
+};
+
+struct history history = {.fd = -1};
+
+int compare_entries(const void *a, const void *b, void *data);
+int compare_offsets(const void *a, const void *b);
+int compare_prefix(uint32_t entry, char *prefix, size_t length);
+int compare_text(uint32_t a, uint32_t b);
+void drop_history(void);
+void drop_index(void);
+size_t entry_length(uint32_t entry);
+int64_t find_entry(char *prefix, size_t length);
+size_t keep_latest(uint32_t *entries, size_t count);
+void load_index(struct stat *st);
+void merge_recent(struct stat *st);
+int open_history(void);
+void prefix_range(char *prefix, size_t length, size_t *first, size_t *last);
+void print_matches(char *prefix);
+void save_index(struct stat *st);
+int update_history(void);
+
+/**
+ * Appends line to the history as one record. Blank lines are left out.
+ */
+void add_history(char *line) {
+    struct iovec iov[2] = {{line, strlen(line)}, {"\n", 1}};
+
+    if (line[strspn(line, " \t")] == '\0' || open_history() == -1) {
+        return;
+    }
+
+    if (writev(history.fd, iov, 2) == -1) {
+        fprintf(stderr, "smallsh: history: %s: %s\n", history.path,
+                strerror(errno));
+        close(history.fd);
+        history.fd = -1;
+        history.failed = true;
+    }
+}
+
+/**
+ * Orders the entries at offsets a and b by text, then by offset, for
+ * qsort_r().
+ */
+int compare_entries(const void *a, const void *b, void *data) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    int order = compare_text(x, y);
+
+    return order != 0 ? order : (x > y) - (x < y);
+}
+
+/**
+ * Orders the entries at offsets a and b by offset, for qsort().
+ */
+int compare_offsets(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Compares the entry at offset entry with the prefix of length bytes.
+ *
+ * Returns 0 if the entry starts with prefix, else less or more than 0 as
+ * the entry sorts before or after every entry that does.
+ */
+int compare_prefix(uint32_t entry, char *prefix, size_t length) {
+    size_t entry_len = entry_length(entry);
+    int order = memcmp(history.base + entry, prefix,
+                       entry_len < length ? entry_len : length);
+
+    if (order != 0) {
+        return order;
+    }
+    return entry_len < length ? -1 : 0;
+}
+
+/**
+ * Compares the text of the entries at offsets a and b, as strcmp() would.
+ */
+int compare_text(uint32_t a, uint32_t b) {
+    size_t a_len = entry_length(a), b_len = entry_length(b);
+    int order = memcmp(history.base + a, history.base + b,
+                       a_len < b_len ? a_len : b_len);
+
+    return order != 0 ? order : (a_len > b_len) - (a_len < b_len);
+}
+
+/**
+ * Forgets everything read from the history, as after it has been truncated.
+ */
+void drop_history(void) {
+    drop_index();
+    if (history.base != NULL) {
+        munmap(history.base, history.mapped);
+    }
+    history.base = NULL;
+    history.mapped = 0;
+    history.size = 0;
+    history.recent_count = 0;
+    history.scanned = 0;
+}
+
+/**
+ * Releases the index, leaving none.
+ */
+void drop_index(void) {
+    if (history.index_map != NULL) {
+        munmap(history.index_map, history.index_map_size);
+    } else {
+        free(history.index);
+    }
+    history.index = NULL;
+    history.index_map = NULL;
+    history.count = 0;
+    history.covered = 0;
+}
+
+/**
+ * Returns the number of bytes in the entry at offset entry, without its
+ * newline.
+ */
+size_t entry_length(uint32_t entry) {
+    char *end = memchr(history.base + entry, '\n', history.size - entry);
+
+    return end - (history.base + entry);
+}
+
+/**
+ * Returns the offset of the latest entry starting with the prefix of length
+ * bytes, or -1 if there is none.
+ */
+int64_t find_entry(char *prefix, size_t length) {
+    size_t first, last;
+    int64_t latest = -1;
+
+    // The recent entries are all later than the indexed ones.
+    for (size_t i = history.recent_count; i-- > 0;) {
+        if (compare_prefix(history.recent[i], prefix, length) == 0) {
+            return history.recent[i];
+        }
+    }
+
+    prefix_range(prefix, length, &first, &last);
+    for (size_t i = first; i < last; i++) {
+        if (history.index[i] > latest) {
+            latest = history.index[i];
+        }
+    }
+
+    return latest;
+}
+
+/**
+ * Runs the history built-in.
+ */
+int history_command(char *argv[], int argc, JobTable jobs) {
+    long count = -1;
+    size_t start;
+    char *end;
+
+    if (argc >= 3 && strcmp(argv[1], "-p") == 0) {
+        // The words after -p make up the prefix, separated by spaces.
+        size_t size = 0;
+        char *prefix;
+
+        for (int i = 2; i < argc; i++) {
+            size += strlen(argv[i]) + 1;
+        }
+        prefix = malloc(size);
+        prefix[0] = '\0';
+        for (int i = 2; i < argc; i++) {
+            strcat(prefix, argv[i]);
+            if (i + 1 < argc) {
+                strcat(prefix, " ");
+            }
+        }
+
+        print_matches(prefix);
+        free(prefix);
+        return NO_STATUS;
+    }
+
+    if (argc == 2) {
+        count = strtol(argv[1], &end, 10);
+    }
+    if (argc > 2 || (argc == 2 && (*end != '\0' || end == argv[1] ||
+                                   count < 0))) {
+        printf("smallsh: history: usage: history [N] | -p PREFIX ...\n");
+        fflush(stdout);
+        return NO_STATUS;
+    }
+
+    if (update_history() == -1) {
+        return NO_STATUS;
+    }
+
+    // Step back over the last count entries, or to the start.
+    start = count < 0 ? 0 : history.size;
+    for (; count > 0 && start > 0; count--) {
+        char *newline = memrchr(history.base, '\n', start - 1);
+
+        start = newline != NULL ? newline - history.base + 1 : 0;
+    }
+
+    fwrite(history.base + start, 1, history.size - start, stdout);
+    fflush(stdout);
+
+    return NO_STATUS;
+}
+
+/**
+ * Sorts the count entries at entries by text and keeps only the latest of
+ * each text.
+ *
+ * Returns the number kept, at the start of entries.
+ */
+size_t keep_latest(uint32_t *entries, size_t count) {
+    size_t kept = 0;
+
+    qsort_r(entries, count, sizeof(uint32_t), compare_entries, NULL);
+    for (size_t i = 0; i < count; i++) {
+        if (kept > 0 && compare_text(entries[kept - 1], entries[i]) == 0) {
+            entries[kept - 1] = entries[i];
+        } else {
+            entries[kept++] = entries[i];
+        }
+    }
+
+    return kept;
+}
+
+/**
+ * Maps the index of the history file described by st, if there is one, it
+ * indexes the history as it is now and its offsets are all within what it
+ * covers.
+ */
+void load_index(struct stat *st) {
+    char path[PATH_MAX];
+    struct history_header *header;
+    struct stat index_st;
+    size_t tail;
+    char *map = MAP_FAILED;
+    int fd;
+
+    history.index_loaded = true;
+    snprintf(path, sizeof(path), "%s.idx", history.path);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+    if (fstat(fd, &index_st) == 0 &&
+        (size_t)index_st.st_size >= sizeof(struct history_header)) {
+        map = mmap(NULL, index_st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+
+    header = (struct history_header *)map;
+    tail = header->covered < HISTORY_TAIL ? header->covered : HISTORY_TAIL;
+    if (memcmp(header->magic, HISTORY_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != HISTORY_VERSION || header->dev != st->st_dev ||
+        header->ino != st->st_ino || header->covered > history.size ||
+        (size_t)index_st.st_size !=
+            sizeof(*header) + header->count * sizeof(uint32_t) ||
+        (tail > 0 && memcmp(header->tail,
+                            history.base + header->covered - tail, tail) !=
+                         0) ||
+        (header->covered > 0 &&
+         history.base[header->covered - 1] != '\n')) {
+        munmap(map, index_st.st_size);
+        return;
+    }
+
+    // Each entry must end within what is covered, so that entry_length()
+    // finds its newline.
+    for (uint32_t i = 0; i < header->count; i++) {
+        if (((uint32_t *)(map + sizeof(*header)))[i] >= header->covered) {
+            munmap(map, index_st.st_size);
+            return;
+        }
+    }
+
+    history.index_map = map;
+    history.index_map_size = index_st.st_size;
+    history.index = (uint32_t *)(map + sizeof(*header));
+    history.count = header->count;
+    history.covered = header->covered;
+    history.scanned = header->covered;
+}
+
+/**
+ * Merges the recent entries into the index, which then covers everything
+ * scanned, and saves the index for the history file described by st.
+ */
+void merge_recent(struct stat *st) {
+    uint32_t *merged = malloc((history.count + history.recent_count) *
+                              sizeof(uint32_t));
+    size_t kept = keep_latest(history.recent, history.recent_count);
+    size_t i = 0, j = 0, n = 0;
+
+    // Where both have an entry, the recent one is the later.
+    while (i < history.count || j < kept) {
+        int order = i == history.count ? 1
+                    : j == kept        ? -1
+                                       : compare_text(history.index[i],
+                                                      history.recent[j]);
+
+        if (order < 0) {
+            merged[n++] = history.index[i++];
+        } else {
+            i += order == 0;
+            merged[n++] = history.recent[j++];
+        }
+    }
+
+    drop_index();
+    history.index = merged;
+    history.count = n;
+    history.covered = history.scanned;
+    history.recent_count = 0;
+
+    save_index(st);
+}
+
+/**
+ * Opens the history file to append to it, if it is not open yet.
+ *
+ * Returns 0 if successful, -1 if history is off or the file cannot be
+ * opened, which is reported once.
+ */
+int open_history(void) {
+    char *value;
+
+    if (history.fd != -1) {
+        return 0;
+    }
+    if (history.failed) {
+        return -1;
+    }
+
+    if ((value = getenv(HISTORY_ENV)) != NULL) {
+        snprintf(history.path, sizeof(history.path), "%s", value);
+    } else if ((value = getenv("HOME")) != NULL) {
+        snprintf(history.path, sizeof(history.path), "%s/%s", value,
+                 HISTORY_FILE);
+    }
+    if (history.path[0] == '\0') {
+        history.failed = true;
+        return -1;
+    }
+
+    history.fd = open(history.path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+                      0600);
+    if (history.fd == -1) {
+        fprintf(stderr, "smallsh: history: %s: %s\n", history.path,
+                strerror(errno));
+        history.failed = true;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Finds the indexed entries starting with the prefix of length bytes, which
+ * are together in the index, storing the index of the first in first and of
+ * the one after the last in last.
+ */
+void prefix_range(char *prefix, size_t length, size_t *first,
+                  size_t *last) {
+    size_t low = 0, high = history.count;
+
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+
+        if (compare_prefix(history.index[middle], prefix, length) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    *first = low;
+
+    high = history.count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+
+        if (compare_prefix(history.index[middle], prefix, length) == 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    *last = low;
+}
+
+/**
+ * Prints the distinct entries starting with prefix, each where it was last
+ * used, oldest first.
+ */
+void print_matches(char *prefix) {
+    size_t length = strlen(prefix), first, last, count, kept;
+    uint32_t *matches;
+
+    if (update_history() == -1) {
+        return;
+    }
+
+    prefix_range(prefix, length, &first, &last);
+    matches = malloc((last - first + history.recent_count + 1) *
+                     sizeof(uint32_t));
+    memcpy(matches, history.index + first, (last - first) * sizeof(uint32_t));
+    count = last - first;
+    for (size_t i = 0; i < history.recent_count; i++) {
+        if (compare_prefix(history.recent[i], prefix, length) == 0) {
+            matches[count++] = history.recent[i];
+        }
+    }
+
+    kept = keep_latest(matches, count);
+    qsort(matches, kept, sizeof(uint32_t), compare_offsets);
+    for (size_t i = 0; i < kept; i++) {
+        fwrite(history.base + matches[i], 1, entry_length(matches[i]) + 1,
+               stdout);
+    }
+    fflush(stdout);
+
+    free(matches);
+}
+
+/**
+ * Recalls a history entry for line if its first word is !! or !prefix,
+ * printing the line it becomes.
+ *
+ * Returns line, the recalled entry followed by the rest of line, allocated
+ * from arena, or NULL if there is no such entry, which is reported.
+ */
+char *recall_history(Arena arena, char *line) {
+    size_t word = strcspn(line, " \t"), length;
+    int64_t entry = -1;
+    char *recalled;
+
+    if (line[0] != '!' || word == 1) {
+        return line;
+    }
+
+    if (update_history() == 0) {
+        if (word == 2 && line[1] == '!') {
+            // The last entry.
+            char *newline = history.size > 0
+                                ? memrchr(history.base, '\n', history.size - 1)
+                                : NULL;
+
+            entry = history.size == 0 ? -1
+                    : newline != NULL ? newline - history.base + 1
+                                      : 0;
+        } else {
+            entry = find_entry(line + 1, word - 1);
+        }
+    }
+
+    if (entry == -1) {
+        printf("smallsh: %.*s: event not found\n", (int)word, line);
+        fflush(stdout);
+        return NULL;
+    }
+
+    length = entry_length(entry);
+    recalled = arena_alloc(arena, length + strlen(line + word) + 1);
+    memcpy(recalled, history.base + entry, length);
+    strcpy(recalled + length, line + word);
+
+    printf("%s\n", recalled);
+    fflush(stdout);
+
+    return recalled;
+}
+
+/**
+ * Writes the index for the history file described by st, through a
+ * temporary file so that no other smallsh reads it half written. A failure
+ * only means the index is built again.
+ */
+void save_index(struct stat *st) {
+    struct history_header header = {HISTORY_MAGIC, HISTORY_VERSION};
+    char path[PATH_MAX], tmp_path[PATH_MAX + 16];
+    size_t tail = history.covered < HISTORY_TAIL ? history.covered
+                                                 : HISTORY_TAIL;
+    struct iovec iov[2];
+    ssize_t expected, written;
+    int fd;
+
+    header.count = history.count;
+    header.dev = st->st_dev;
+    header.ino = st->st_ino;
+    header.covered = history.covered;
+    memcpy(header.tail, history.base + history.covered - tail, tail);
+
+    snprintf(path, sizeof(path), "%s.idx", history.path);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        return;
+    }
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = history.index;
+    iov[1].iov_len = history.count * sizeof(uint32_t);
+    expected = iov[0].iov_len + iov[1].iov_len;
+    written = writev(fd, iov, 2);
+    close(fd);
+
+    if (written != expected || rename(tmp_path, path) == -1) {
+        unlink(tmp_path);
+    }
+}
+
+/**
+ * Brings what is known of the history up to date with the file: maps it
+ * again if it has grown, loads the index the first time, and collects the
+ * entries that are new, merging them into the index if there are enough.
+ *
+ * Returns 0 if successful, -1 if there is no history to search.
+ */
+int update_history(void) {
+    struct stat st;
+    size_t length;
+    char *end;
+
+    if (open_history() == -1 || fstat(history.fd, &st) == -1) {
+        return -1;
+    }
+
+    // A history that has shrunk is not the one read before.
+    if ((size_t)st.st_size < history.size) {
+        drop_history();
+        history.index_loaded = false;
+    }
+
+    length = st.st_size < UINT32_MAX ? st.st_size : UINT32_MAX;
+    if (length > history.mapped) {
+        char *base = mmap(NULL, length, PROT_READ, MAP_SHARED, history.fd, 0);
+
+        if (base == MAP_FAILED) {
+            perror("smallsh: history: mmap()");
+            return -1;
+        }
+        if (history.base != NULL) {
+            munmap(history.base, history.mapped);
+        }
+        history.base = base;
+        history.mapped = length;
+    }
+
+    // Only whole lines are entries.
+    end = history.mapped > history.size
+              ? memrchr(history.base + history.size, '\n',
+                        history.mapped - history.size)
+              : NULL;
+    if (end != NULL) {
+        history.size = end - history.base + 1;
+    }
+
+    if (!history.index_loaded) {
+        load_index(&st);
+    }
+
+    while (history.scanned < history.size) {
+        if (history.recent_count == history.recent_capacity) {
+            history.recent_capacity = history.recent_capacity == 0
+                                          ? 64
+                                          : history.recent_capacity * 2;
+            history.recent = realloc(history.recent, history.recent_capacity *
+                                                         sizeof(uint32_t));
+        }
+        history.recent[history.recent_count++] = history.scanned;
+        history.scanned += entry_length(history.scanned) + 1;
+    }
+
+    if (history.recent_count > HISTORY_RECENT_MAX) {
+        merge_recent(&st);
+    }
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "arena.h"
+#include "processes.h"
+#include <stdint.h>
+
+// Environment variable naming the history file, where an empty value turns
+// history off.
+#define HISTORY_ENV "SMALLSH_HISTORY"
+
+// The history file in the home directory, unless $SMALLSH_HISTORY is set.
+#define HISTORY_FILE ".smallsh_history"
+
+// Identifies history indexes; the version changes with the layout.
+#define HISTORY_MAGIC "smshhix"
+#define HISTORY_VERSION 1
+
+// Bytes at the end of the indexed history that its index keeps a copy of,
+// to tell that the history is still the one it indexed.
+#define HISTORY_TAIL 32
+
+// Entries after the indexed part of the history that are searched one by
+// one before they are merged into the index.
+#define HISTORY_RECENT_MAX 4096
+
+/**
+ * Start of a history index, which the offsets of count entries follow.
+ *
+ * Fields:
+ * count : number of entries in the index
+ * dev, ino : the history file indexed
+ * covered : number of bytes of the history indexed
+ * tail : the last bytes of those, or all of them if there are fewer
+ */
+struct history_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t covered;
+    char tail[HISTORY_TAIL];
+};
+
+void add_history(char *line);
+int history_command(char *argv[], int argc, JobTable jobs);
+char *recall_history(Arena arena, char *line);
+
+#endif
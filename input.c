@@ -0,0 +1,192 @@
+/**
+ * Buffered source of command lines for smallsh, read from a terminal, a
+ * script file, or a string given with -c.
+ *
+ * Input that is not a terminal is read INPUT_BLOCK bytes at a time and split
+ * into lines in place, rather than with one stdio call per line.
+ *
+ * Reading is driven by the event loop: fill_input() is called once the
+ * descriptor is readable, so it never blocks on a terminal or pipe, and
+ * read_line() assembles lines from what has been read so far.
+ */
+
+#include "input.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/**
+ * Buffer of bytes read but not yet returned as lines.
+ *
+ * Fields:
+ * fd : file descriptor read from, or -1 for a string
+ * buf : bytes read, of which buf[start] through buf[end - 1] are unreturned
+ * size : capacity of buf, which grows to hold any line
+ * at_eof : whether fd has reached end of file
+ * interactive : whether fd is a terminal, which smallsh prompts on
+ */
+struct input {
+    int fd;
+    char *buf;
+    size_t start;
+    size_t end;
+    size_t size;
+    bool at_eof;
+    bool interactive;
+};
+
+/**
+ * Frees in, closing its file unless that is stdin.
+ */
+void close_input(Input in) {
+    if (in->fd > STDIN_FILENO) {
+        close(in->fd);
+    }
+    free(in->buf);
+    free(in);
+}
+
+/**
+ * Reads further input onto the end of the buffer with a single read(), first
+ * moving any partial line to the front and growing the buffer if that line
+ * fills it.
+ *
+ * Returns the number of bytes read, or 0 at end of file.
+ */
+int fill_input(Input in) {
+    ssize_t bytes;
+
+    if (in->start > 0) {
+        memmove(in->buf, in->buf + in->start, in->end - in->start);
+        in->end -= in->start;
+        in->start = 0;
+    }
+
+    if (in->end == in->size) {
+        in->size *= 2;
+        in->buf = realloc(in->buf, in->size);
+    }
+
+    do {
+        bytes = read(in->fd, in->buf + in->end, in->size - in->end);
+    } while (bytes == -1 && errno == EINTR);
+
+    if (bytes == -1) {
+        perror("read()");
+        bytes = 0;
+    }
+
+    if (bytes == 0) {
+        in->at_eof = true;
+    }
+    in->end += bytes;
+
+    return bytes;
+}
+
+/**
+ * Returns whether all of in has been read.
+ */
+bool input_at_eof(Input in) {
+    return in->at_eof && in->start == in->end;
+}
+
+/**
+ * Returns the descriptor in reads from, or -1 if it holds a string.
+ */
+int input_fd(Input in) {
+    return in->fd;
+}
+
+/**
+ * Returns whether in is a terminal that smallsh should prompt on.
+ */
+bool input_is_interactive(Input in) {
+    return in->interactive;
+}
+
+/**
+ * Creates an input reading lines from the file descriptor fd.
+ */
+Input open_input(int fd) {
+    Input in = calloc(1, sizeof(struct input));
+
+    in->fd = fd;
+    in->interactive = isatty(fd);
+    in->size = INPUT_BLOCK;
+    in->buf = malloc(in->size);
+
+    return in;
+}
+
+/**
+ * Returns the next line of input, without its newline. A final line that
+ * lacks a newline is returned as well.
+ *
+ * The line is stored in in's buffer and may be modified by the caller, but
+ * is only valid until the next call.
+ *
+ * Returns NULL at end of input, or when no whole line has been read yet, in
+ * which case fill_input() should be called once more input is ready.
+ */
+char *read_line(Input in) {
+    char *line = in->buf + in->start;
+    char *newline = memchr(line, '\n', in->end - in->start);
+
+    if (newline != NULL) {
+        *newline = '\0';
+        in->start = newline - in->buf + 1;
+        return line;
+    }
+
+    if (!in->at_eof || in->start == in->end) {
+        return NULL;
+    }
+
+    // Terminate the final line, making room if the buffer is full.
+    if (in->end == in->size) {
+        in->size += 1;
+        in->buf = realloc(in->buf, in->size);
+        line = in->buf + in->start;
+    }
+    in->buf[in->end] = '\0';
+    in->start = in->end;
+    return line;
+}
+
+/**
+ * Creates an input holding the lines of text, as given to smallsh -c.
+ */
+Input string_input(char *text) {
+    Input in = calloc(1, sizeof(struct input));
+
+    in->fd = -1;
+    in->size = strlen(text) + 1;
+    in->buf = malloc(in->size);
+    memcpy(in->buf, text, in->size);
+    in->end = in->size - 1;
+    in->at_eof = true;
+
+    return in;
+}
+
+/**
+ * Moves the file offset of stdin back to the start of the unread input, so
+ * that a child process reading the shared stdin sees the lines smallsh has
+ * not yet run. Pipes and terminals cannot seek and are left as they are.
+ */
+void sync_input(Input in) {
+    if (in->fd != STDIN_FILENO || in->interactive ||
+        in->start == in->end) {
+        return;
+    }
+
+    if (lseek(in->fd, -(off_t)(in->end - in->start), SEEK_CUR) != -1) {
+        in->start = 0;
+        in->end = 0;
+        in->at_eof = false;
+    }
+}
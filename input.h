@@ -0,0 +1,25 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdbool.h>
+
+// Number of bytes requested from the input file by each read.
+#define INPUT_BLOCK 65536
+
+// Incomplete type to encapsulate its data structure.
+// The struct is implemented in input.c.
+struct input;
+
+typedef struct input *Input;
+
+void close_input(Input in);
+int fill_input(Input in);
+bool input_at_eof(Input in);
+int input_fd(Input in);
+bool input_is_interactive(Input in);
+Input open_input(int fd);
+char *read_line(Input in);
+Input string_input(char *text);
+void sync_input(Input in);
+
+#endif
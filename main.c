@@ -1,85 +1,265 @@
 #include "commands.h"
+#include "events.h"
+#include "history.h"
+#include "input.h"
 #include "processes.h"
+#include "script.h"
+#include "server.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 // For toggling foreground-only mode.
 int fg_only = 0;
 
-void handle_SIGTSTP_fg_on(int signo);
-void handle_SIGTSTP_fg_off(int signo);
+void deadline_ready(int fd, void *data);
+void input_ready(int fd, void *data);
+void print_usage_and_exit(void);
+void show_prompt(Input input);
+void toggle_fg_only(Input input);
+void wait_for_input(Input input, bool watch_input, JobTable jobs);
 
 /*
  * Entry point to the smallsh C program.
+ *
+ * Usage:
+ *  smallsh                 read commands from stdin
+ *  smallsh script          run the commands of the file script
+ *  smallsh -c commands     run the lines of the string commands
+ *  smallsh --serve socket [-j N]
+ *                          run the command lines of clients connecting to
+ *                          the UNIX domain socket socket, N at a time
+ *
+ * The prompt is only printed when commands are read from a terminal. A
+ * script is run from its compiled form in the script cache, compiled on its
+ * first run, and read line by line only if the cache cannot be used.
+ *
+ * Between commands, smallsh waits in its event loop for input and signals
+ * together, so finished background jobs are reported as soon as they end
+ * and Ctrl-z takes effect at once at the prompt. During a foreground command
+ * the signals are held, and handled once it has finished.
  */
-int main(void) {
+int main(int argc, char *argv[]) {
     Command curr_cmd;
-    Process procs = NULL;
-    struct sigaction SIGINT_action = {0};
-    struct sigaction SIGTSTP_action = {0};
+    JobTable jobs = new_job_table();
+    Arena arena = new_arena();
+    Script script = NULL;
+    char *serve_path = NULL;
+    Input input = NULL;
+    char *line;
+    bool watch_input;
+
+    if (argc == 1) {
+        input = open_input(STDIN_FILENO);
+    } else if (argc == 2 && strcmp(argv[1], "-c") != 0) {
+        int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            perror(argv[1]);
+            exit(EXIT_FAILURE);
+        }
+        input = open_input(fd);
+        script = load_script(argv[1], fd);
+    } else if (argc == 3 && strcmp(argv[1], "-c") == 0) {
+        input = string_input(argv[2]);
+    } else if ((argc == 3 || (argc == 5 && strcmp(argv[3], "-j") == 0)) &&
+               strcmp(argv[1], "--serve") == 0) {
+        serve_path = argv[2];
+        if (argc == 5) {
+            char *end;
+            long limit = strtol(argv[4], &end, 10);
+
+            if (*end != '\0' || argv[4][0] == '\0' || limit < 0 ||
+                limit > INT_MAX) {
+                print_usage_and_exit();
+            }
+            set_job_limit(jobs, limit);
+        }
+    } else {
+        print_usage_and_exit();
+    }
+
+    // Tracing is on when $SMALLSH_TRACE names a file.
+    trace_open(getenv(TRACE_ENV));
+
+    // SIGCHLD, SIGINT and SIGTSTP are blocked and read by the event loop,
+    // which also keeps the deadlines of jobs started with limit.
+    open_events();
+    if (job_timer_fd(jobs) != -1) {
+        add_busy_event(job_timer_fd(jobs), deadline_ready, jobs);
+    }
 
-    // Register handler to ignore SIGINT.
-    SIGINT_action.sa_handler = SIG_IGN;
-    // Install the handler.
-    sigaction(SIGINT, &SIGINT_action, NULL);
+    if (serve_path != NULL) {
+        int result = serve(serve_path, jobs);
 
-    // Register SIGTSTP handler to turn on foreground-only mode.
-    SIGTSTP_action.sa_handler = handle_SIGTSTP_fg_on;
-    // Install the handler.
-    sigaction(SIGTSTP, &SIGTSTP_action, NULL);
+        kill_all(jobs);
+        exit(result);
+    }
+
+    // Regular files are always ready to read, so only terminals and pipes
+    // are watched.
+    watch_input = input_fd(input) != -1 &&
+                  add_event(input_fd(input), input_ready, input) == 0;
 
     while (true) {
-        procs = check_bg_processes(procs);
+        // Signals that arrived during the last command take effect now. A
+        // Ctrl-c has already interrupted the command itself.
+        read_signals();
+        take_signal(SIGINT);
+        if (take_signal(SIGTSTP)) {
+            toggle_fg_only(input);
+        }
+        check_bg_processes(jobs, false);
+
+        if (script != NULL) {
+            // A compiled script has no lines to wait for, and holds no
+            // blank lines or comments.
+            run_events(0);
+            curr_cmd = next_command(script, arena, fg_only);
+            if (curr_cmd == NULL) {
+                break;
+            }
+        } else {
+            show_prompt(input);
+            while ((line = read_line(input)) == NULL && !input_at_eof(input)) {
+                wait_for_input(input, watch_input, jobs);
+            }
+            if (line == NULL) {
+                break;
+            }
+
+            // Lines typed at the terminal are kept in the history, after
+            // any entry they recall with ! has replaced the first word.
+            if (input_is_interactive(input)) {
+                line = recall_history(arena, line);
+                if (line == NULL) {
+                    continue;
+                }
+                add_history(line);
+            }
+
+            TRACE(TRACE_PARSE_START, 0, strlen(line));
+            curr_cmd = parse_command(arena, line, fg_only);
+            TRACE(TRACE_PARSE_END, 0, curr_cmd != NULL);
 
-        curr_cmd = parse_command(fg_only);
+            // parse_command() returns NULL when i/o redirection is followed by
+            // command arguments, when the entry is blank, and when it is a
+            // comment.
+            if (curr_cmd == NULL) {
+                arena_reset(arena);
+                continue;
+            }
 
-        // parse_command() returns NULL when i/o redirection is followed by
-        // command arguments, when the entry is blank, and when it is a comment.
-        if (curr_cmd == NULL) {
-            continue;
+            // Children sharing stdin should start reading after this line.
+            // Other commands leave the input buffered.
+            if (reads_stdin(curr_cmd)) {
+                sync_input(input);
+            }
         }
 
-        procs = process_command(curr_cmd, procs);
+        process_command(arena, curr_cmd, jobs);
 
-        // Free memory before parsing another command.
-        free_command(curr_cmd);
+        // Release the command's memory before parsing another.
+        arena_reset(arena);
     }
 
+    if (script != NULL) {
+        close_script(script);
+    }
+    close_input(input);
+    free_arena(arena);
+    kill_all(jobs);
+
     exit(EXIT_SUCCESS);
 }
 
 /**
- * SIGTSTP handler function to turn on foreground-only mode.
- *
- * Registers its counterpart handler function to turn off foreground-only mode.
+ * Signals the jobs whose time limits have passed.
+ */
+void deadline_ready(int fd, void *data) {
+    expire_jobs(data);
+}
+
+/**
+ * Reads the input that has become ready.
+ */
+void input_ready(int fd, void *data) {
+    fill_input(data);
+}
+
+/**
+ * Prints how smallsh is run and exits with failure.
  */
-void handle_SIGTSTP_fg_on(int signo) {
-    struct sigaction SIGTSTP_action = {0};
+void print_usage_and_exit(void) {
+    fprintf(stderr, "usage: smallsh [script | -c commands | "
+                    "--serve socket [-j N]]\n");
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Prints the prompt if input is a terminal.
+ */
+void show_prompt(Input input) {
+    if (input_is_interactive(input)) {
+        printf(PROMPT);
+        fflush(stdout);
+    }
+}
 
-    // Register SIGTSTP handler to turn on foreground-only mode.
-    SIGTSTP_action.sa_handler = handle_SIGTSTP_fg_off;
-    // Install the handler.
-    sigaction(SIGTSTP, &SIGTSTP_action, NULL);
+/**
+ * Turns foreground-only mode, in which & is ignored, on or off. On a
+ * terminal, the message starts a line of its own after the echoed ^Z.
+ */
+void toggle_fg_only(Input input) {
+    fg_only = !fg_only;
 
-    write(STDOUT_FILENO, "Entering foreground-only mode (& is now ignored)\n",
-          50);
-    fg_only = 1;
+    if (input_is_interactive(input)) {
+        printf("\n");
+    }
+    if (fg_only) {
+        printf("Entering foreground-only mode (& is now ignored)\n");
+    } else {
+        printf("Exiting foreground-only mode\n");
+    }
+    fflush(stdout);
 }
 
 /**
- * SIGTSTP handler function to turn off foreground-only mode.
+ * Waits for more of input, or for signals, and handles them. A prompt that
+ * has been printed is printed again after any messages.
  *
- * Registers its counterpart handler function to turn on foreground-only mode.
+ * A regular file is always ready, so when input is not watched by the event
+ * loop it is read straight away, and only signals already received are
+ * handled.
  */
-void handle_SIGTSTP_fg_off(int signo) {
-    struct sigaction SIGTSTP_action = {0};
+void wait_for_input(Input input, bool watch_input, JobTable jobs) {
+    bool interactive = input_is_interactive(input);
 
-    // Register SIGTSTP handler to turn on foreground-only mode.
-    SIGTSTP_action.sa_handler = handle_SIGTSTP_fg_on;
-    // Install the handler.
-    sigaction(SIGTSTP, &SIGTSTP_action, NULL);
+    if (watch_input) {
+        run_events(-1);
+    } else {
+        fill_input(input);
+        run_events(0);
+    }
 
-    write(STDOUT_FILENO, "Exiting foreground-only mode\n", 30);
-    fg_only = 0;
+    // A finished background job is reported right away.
+    if (take_signal(SIGCHLD) && check_bg_processes(jobs, interactive) > 0) {
+        show_prompt(input);
+    }
+
+    if (take_signal(SIGTSTP)) {
+        toggle_fg_only(input);
+        show_prompt(input);
+    }
+
+    // Ctrl-c abandons the line being entered, which the terminal discards.
+    if (take_signal(SIGINT) && interactive) {
+        printf("\n");
+        show_prompt(input);
+    }
 }
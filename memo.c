@@ -0,0 +1,400 @@
+/**
+ * The memo cache, which keeps the output and exit status of commands run
+ * with the memo keyword so that running them again replays the output
+ * without starting a process.
+ *
+ * Each entry is a file in the cache directory named by the hex SHA-256 key
+ * of what the command depends on, as computed by memo_key() in commands.c.
+ * It holds the command's output followed by a struct memo_trailer. An entry
+ * is written under a temporary name and renamed into place once complete, so
+ * a reader never sees part of one. Entries whose trailer does not match are
+ * removed when found.
+ *
+ * The cache is bounded by $SMALLSH_MEMO_SIZE bytes, MEMO_MAX_SIZE by default.
+ * Every hit sets its entry's modification time, and after each new entry the
+ * least recently used are removed until the cache fits, along with entries
+ * left unfinished by a smallsh that was killed while writing them.
+ *
+ * The directory is $SMALLSH_MEMO_DIR, else $XDG_CACHE_HOME/smallsh/memo,
+ * else ~/.cache/smallsh/memo, and is created when first needed. The other
+ * caches smallsh keeps on disk are found the same way.
+ */
+
+#define _GNU_SOURCE
+#include "memo.h"
+#include "commands.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Bytes copied at a time when sendfile() cannot be used.
+#define MEMO_COPY_SIZE 65536
+
+/**
+ * An entry found while evicting.
+ */
+struct memo_file {
+    char name[SHA256_SIZE * 2 + 1];
+    struct timespec used;
+    off_t size;
+};
+
+// The cache directory, or "" before it is first needed.
+char memo_dir[PATH_MAX] = "";
+
+// Whether the cache directory could not be created, which is reported once.
+bool memo_failed = false;
+
+// Where the entry being written is kept until it is complete.
+char memo_tmp[PATH_MAX];
+
+int compare_memo_files(const void *a, const void *b);
+int copy_output(int fd, off_t offset, off_t size);
+char *find_memo_dir(void);
+void memo_evict(void);
+void memo_path(unsigned char key[SHA256_SIZE], char *path);
+void remove_orphan(int dir_fd, char *name);
+
+/**
+ * Orders entries from the least recently used, for qsort().
+ */
+int compare_memo_files(const void *a, const void *b) {
+    const struct memo_file *x = a, *y = b;
+
+    if (x->used.tv_sec != y->used.tv_sec) {
+        return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    }
+    return (x->used.tv_nsec > y->used.tv_nsec) -
+           (x->used.tv_nsec < y->used.tv_nsec);
+}
+
+/**
+ * Writes the bytes of fd from offset to size to stdout through a buffer.
+ * Returns 0 if successful, 1 if not.
+ */
+int copy_output(int fd, off_t offset, off_t size) {
+    char buf[MEMO_COPY_SIZE];
+
+    while (offset < size) {
+        ssize_t got = pread(fd, buf,
+                            size - offset < MEMO_COPY_SIZE ? size - offset
+                                                           : MEMO_COPY_SIZE,
+                            offset);
+        if (got <= 0) {
+            perror("memo: read()");
+            return 1;
+        }
+
+        for (ssize_t done = 0; done < got;) {
+            ssize_t put = write(STDOUT_FILENO, buf + done, got - done);
+            if (put == -1 && errno == EINTR) {
+                continue;
+            }
+            if (put == -1) {
+                perror("memo: write()");
+                return 1;
+            }
+            done += put;
+        }
+        offset += got;
+    }
+
+    return 0;
+}
+
+/**
+ * Finds the directory of smallsh's cache called name, storing its path in
+ * dir, of size bytes: $env if that is set, else $XDG_CACHE_HOME/smallsh/name,
+ * else ~/.cache/smallsh/name. Creates it and its parents if need be.
+ *
+ * Returns dir, or NULL with errno set if it cannot be created.
+ */
+char *find_cache_dir(char *dir, size_t size, char *env, char *name) {
+    char *value;
+
+    if ((value = getenv(env)) != NULL && value[0] != '\0') {
+        snprintf(dir, size, "%s", value);
+    } else if ((value = getenv("XDG_CACHE_HOME")) != NULL &&
+               value[0] != '\0') {
+        snprintf(dir, size, "%s/smallsh/%s", value, name);
+    } else if ((value = getenv("HOME")) != NULL) {
+        snprintf(dir, size, "%s/.cache/smallsh/%s", value, name);
+    } else {
+        snprintf(dir, size, "/tmp/smallsh-%d/%s", (int)getuid(), name);
+    }
+
+    // Create each missing directory along the path.
+    for (char *slash = strchr(dir + 1, '/');; slash = strchr(slash + 1, '/')) {
+        if (slash != NULL) {
+            *slash = '\0';
+        }
+        if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+            return NULL;
+        }
+        if (slash == NULL) {
+            break;
+        }
+        *slash = '/';
+    }
+
+    return dir;
+}
+
+/**
+ * Returns the memo cache directory, or NULL if it cannot be created, which
+ * is reported the first time.
+ */
+char *find_memo_dir(void) {
+    if (memo_dir[0] != '\0') {
+        return memo_dir;
+    }
+    if (memo_failed) {
+        return NULL;
+    }
+
+    if (find_cache_dir(memo_dir, sizeof(memo_dir), MEMO_DIR_ENV, "memo") ==
+        NULL) {
+        fprintf(stderr, "smallsh: memo: cannot create %s: %s\n", memo_dir,
+                strerror(errno));
+        memo_dir[0] = '\0';
+        memo_failed = true;
+        return NULL;
+    }
+
+    return memo_dir;
+}
+
+/**
+ * Starts a new entry, returning the file the command's output should be
+ * written to, or NULL if the cache cannot be used.
+ */
+char *memo_begin(void) {
+    char *dir = find_memo_dir();
+
+    if (dir == NULL) {
+        return NULL;
+    }
+
+    snprintf(memo_tmp, sizeof(memo_tmp), "%s/tmp.%d", dir, (int)getpid());
+    return memo_tmp;
+}
+
+/**
+ * Removes the least recently used entries until the cache holds no more
+ * than its size limit, and the unfinished entries of shells that are gone.
+ */
+void memo_evict(void) {
+    char *env = getenv(MEMO_SIZE_ENV);
+    long long limit = env != NULL ? atoll(env) : 0;
+    struct memo_file *files = NULL;
+    size_t count = 0, capacity = 0;
+    long long total = 0;
+    struct dirent *entry;
+    struct stat st;
+    DIR *dir;
+
+    if (limit <= 0) {
+        limit = MEMO_MAX_SIZE;
+    }
+
+    dir = opendir(memo_dir);
+    if (dir == NULL) {
+        return;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "tmp.", 4) == 0) {
+            remove_orphan(dirfd(dir), entry->d_name);
+            continue;
+        }
+        if (strlen(entry->d_name) != SHA256_SIZE * 2 ||
+            fstatat(dirfd(dir), entry->d_name, &st, 0) == -1) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            files = realloc(files, capacity * sizeof(struct memo_file));
+        }
+        strcpy(files[count].name, entry->d_name);
+        files[count].used = st.st_mtim;
+        files[count++].size = st.st_size;
+        total += st.st_size;
+    }
+
+    if (total > limit) {
+        qsort(files, count, sizeof(struct memo_file), compare_memo_files);
+        for (size_t i = 0; i < count && total > limit; i++) {
+            if (unlinkat(dirfd(dir), files[i].name, 0) == 0) {
+                total -= files[i].size;
+            }
+        }
+    }
+
+    closedir(dir);
+    free(files);
+}
+
+/**
+ * Looks up the entry for key. If it is found, stores the status and the
+ * size of the output it holds, marks it as just used and returns a
+ * descriptor from which the output can be read, else returns -1.
+ */
+int memo_lookup(unsigned char key[SHA256_SIZE], int *wstatus, off_t *size) {
+    char path[PATH_MAX];
+    struct memo_trailer trailer;
+    struct stat st;
+    int fd;
+
+    if (find_memo_dir() == NULL) {
+        return -1;
+    }
+
+    memo_path(key, path);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(trailer) ||
+        pread(fd, &trailer, sizeof(trailer), st.st_size - sizeof(trailer)) !=
+            sizeof(trailer) ||
+        memcmp(trailer.magic, MEMO_MAGIC, sizeof(MEMO_MAGIC)) != 0 ||
+        trailer.version != MEMO_VERSION ||
+        trailer.size != st.st_size - sizeof(trailer) ||
+        memcmp(trailer.key, key, SHA256_SIZE) != 0) {
+        // A damaged entry would only ever be missed.
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+
+    futimens(fd, NULL);
+    *wstatus = trailer.wstatus;
+    *size = trailer.size;
+    return fd;
+}
+
+/**
+ * Writes the path of the entry for key into path, of PATH_MAX bytes.
+ */
+void memo_path(unsigned char key[SHA256_SIZE], char *path) {
+    char hex[SHA256_SIZE * 2 + 1];
+
+    sha256_hex(key, hex);
+    snprintf(path, PATH_MAX, "%s/%s", memo_dir, hex);
+}
+
+/**
+ * Writes the first size bytes of fd to stdout, or to out_file if it is not
+ * NULL, which is opened through redirect_out() as for any command. Returns
+ * 0 if successful, 1 if not.
+ */
+int memo_replay(int fd, off_t size, char *out_file) {
+    int saved_out = -1, result = 0;
+    off_t offset = 0;
+
+    fflush(stdout);
+    if (out_file != NULL) {
+        saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+        if (redirect_out(out_file) != 0) {
+            fflush(stdout);
+            restore_fd(saved_out, STDOUT_FILENO);
+            return 1;
+        }
+    }
+
+    // The kernel copies the output without it passing through the shell,
+    // except to the few kinds of file sendfile() cannot write, such as one
+    // opened for appending.
+    while (offset < size) {
+        ssize_t sent = sendfile(STDOUT_FILENO, fd, &offset, size - offset);
+
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent == -1 && (errno == EINVAL || errno == ENOSYS)) {
+            result = copy_output(fd, offset, size);
+            break;
+        }
+        if (sent <= 0) {
+            perror("memo: sendfile()");
+            result = 1;
+            break;
+        }
+    }
+
+    if (out_file != NULL) {
+        restore_fd(saved_out, STDOUT_FILENO);
+    }
+
+    return result;
+}
+
+/**
+ * Completes the entry begun by memo_begin() as the entry for key, holding
+ * the output written so far and wstatus. Only commands that exited are
+ * kept; for any other wstatus, such as -1 for one that did not run or
+ * timed out, the output is dropped. Stores the size of the output in size.
+ *
+ * Returns a descriptor from which the output can be read, or -1 if there is
+ * none.
+ */
+int memo_store(unsigned char key[SHA256_SIZE], int wstatus, off_t *size) {
+    struct memo_trailer trailer = {MEMO_MAGIC, MEMO_VERSION};
+    char path[PATH_MAX];
+    struct stat st;
+    int fd;
+
+    fd = open(memo_tmp, O_RDWR | O_APPEND | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        unlink(memo_tmp);
+        return -1;
+    }
+    *size = st.st_size;
+
+    if (wstatus != -1 && WIFEXITED(wstatus)) {
+        trailer.wstatus = wstatus;
+        trailer.size = st.st_size;
+        memcpy(trailer.key, key, SHA256_SIZE);
+        memo_path(key, path);
+
+        if (write(fd, &trailer, sizeof(trailer)) == sizeof(trailer) &&
+            rename(memo_tmp, path) == 0) {
+            memo_evict();
+            return fd;
+        }
+    }
+
+    // The output is still shown, though it is not kept.
+    unlink(memo_tmp);
+    return fd;
+}
+
+/**
+ * Removes name, an entry written under a temporary name in the directory
+ * dir_fd, if the smallsh whose pid it bears is no longer running, as when
+ * it was killed while the command ran.
+ */
+void remove_orphan(int dir_fd, char *name) {
+    char *end;
+    long pid = strtol(name + 4, &end, 10);
+
+    if (*end == '\0' && pid > 0 && pid <= INT_MAX && kill(pid, 0) == -1 &&
+        errno == ESRCH) {
+        unlinkat(dir_fd, name, 0);
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "sha256.h"
+#include <stdint.h>
+#include <sys/types.h>
+
+// Environment variable naming the directory of the memo cache.
+#define MEMO_DIR_ENV "SMALLSH_MEMO_DIR"
+
+// Environment variable giving the most bytes the memo cache may hold.
+#define MEMO_SIZE_ENV "SMALLSH_MEMO_SIZE"
+
+// Most bytes the memo cache holds unless $SMALLSH_MEMO_SIZE says otherwise.
+#define MEMO_MAX_SIZE (256 * 1024 * 1024)
+
+// Identifies memo cache entries; the version changes with the layout.
+#define MEMO_MAGIC "smshmem"
+#define MEMO_VERSION 1
+
+// End of a memo cache entry, which follows the output it describes.
+struct memo_trailer {
+    char magic[8];
+    uint32_t version;
+    int32_t wstatus;
+    uint64_t size;
+    unsigned char key[SHA256_SIZE];
+};
+
+char *find_cache_dir(char *dir, size_t size, char *env, char *name);
+char *memo_begin(void);
+int memo_lookup(unsigned char key[SHA256_SIZE], int *wstatus, off_t *size);
+int memo_replay(int fd, off_t size, char *out_file);
+int memo_store(unsigned char key[SHA256_SIZE], int wstatus, off_t *size);
+
+#endif
@@ -0,0 +1,433 @@
+/**
+ * The parallel built-in, which runs a command template once for each of a
+ * list of arguments, keeping a fixed number of jobs running at once.
+ *
+ * Usage:
+ *  parallel [-j N] [-g | -k] [-c] command [arg ...] [< argfile]
+ *  parallel [-j N] [-g | -k] [-c] command [arg ...] ::: input ...
+ *
+ * Each line of argfile, or stdin when there is no redirection and it is not a
+ * terminal, is an input.
+ * Every {} in the template is replaced by the input, or the input is
+ * appended if there is no {}. Jobs are started through spawn_command(), like
+ * any foreground command, with stdin from /dev/null.
+ *
+ * Options:
+ *  -j N : run N jobs at once, from 1 to PARALLEL_MAX_JOBS, by default one
+ *      per online CPU
+ *  -g : group output, writing each job's output whole once it finishes
+ *  -k : keep order, writing each job's output whole in input order
+ *  -c : pin each running job to its own CPU
+ *
+ * The status is the number of jobs that failed, up to PARALLEL_MAX_FAILED.
+ */
+
+#define _GNU_SOURCE
+#include "parallel.h"
+#include "arena.h"
+#include "builtins.h"
+#include "commands.h"
+#include "processes.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Size of the buffer used when output cannot be copied with sendfile().
+#define OUTPUT_COPY_SIZE 65536
+
+enum output_mode { OUTPUT_DIRECT, OUTPUT_GROUPED, OUTPUT_ORDERED };
+
+/**
+ * One input and the job run for it.
+ *
+ * Fields:
+ * arg : the input argument
+ * pid : the job's process, or 0 if not started
+ * out_fd : memfd holding the job's output when it is buffered, else -1
+ * done : whether the job has been reaped
+ */
+struct parallel_job {
+    char *arg;
+    pid_t pid;
+    int out_fd;
+    bool done;
+};
+
+char *read_inputs(int fd, size_t *count, char ***inputs);
+void flush_job_output(struct parallel_job *job, int out_fd);
+pid_t start_parallel_job(Arena arena, char **template, int template_argc,
+                         struct parallel_job *job, int null_fd, int out_fd,
+                         enum output_mode mode, int cpu);
+char *substitute(Arena arena, char *word, char *arg);
+
+/**
+ * Runs the parallel built-in, returning its wait status. Its redirections
+ * have already been applied to stdin and stdout.
+ */
+int parallel_command(char *argv[], int argc, JobTable jobs) {
+    enum output_mode mode = OUTPUT_DIRECT;
+    long limit = sysconf(_SC_NPROCESSORS_ONLN);
+    bool pin = false;
+    int first, template_argc, null_fd, out_fd = STDOUT_FILENO;
+    char **template, **inputs = NULL, *input_text = NULL, *end;
+    size_t count = 0;
+    cpu_set_t cpus;
+    int cpu_list[CPU_SETSIZE], ncpus = 0;
+
+    // Options come before the command template.
+    for (first = 1; first < argc && argv[first][0] == '-'; first++) {
+        if (strcmp(argv[first], "-j") == 0) {
+            char *arg;
+
+            // A -j with no count is a usage error.
+            if (first + 1 == argc) {
+                limit = 0;
+                break;
+            }
+            arg = argv[++first];
+
+            limit = strtol(arg, &end, 10);
+            if (*end != '\0' || arg[0] == '\0' || limit < 1 ||
+                limit > PARALLEL_MAX_JOBS) {
+                printf("smallsh: parallel: %s: invalid job count\n", arg);
+                fflush(stdout);
+                return W_EXITCODE(EXIT_FAILURE, 0);
+            }
+        } else if (strcmp(argv[first], "-g") == 0) {
+            mode = OUTPUT_GROUPED;
+        } else if (strcmp(argv[first], "-k") == 0) {
+            mode = OUTPUT_ORDERED;
+        } else if (strcmp(argv[first], "-c") == 0) {
+            pin = true;
+        } else {
+            break;
+        }
+    }
+
+    template = argv + first;
+    template_argc = 0;
+    while (first + template_argc < argc &&
+           strcmp(template[template_argc], PARALLEL_ARGS_SEP) != 0) {
+        template_argc++;
+    }
+
+    if (template_argc == 0 || limit < 1) {
+        printf("smallsh: parallel: usage: parallel [-j N] [-g | -k] [-c] "
+               "command [arg ...] [::: input ...]\n");
+        fflush(stdout);
+        return W_EXITCODE(EXIT_FAILURE, 0);
+    }
+
+    if (first + template_argc < argc) {
+        // Inputs follow the ::: separator.
+        inputs = template + template_argc + 1;
+        count = argc - first - template_argc - 1;
+    } else if (isatty(STDIN_FILENO)) {
+        // Reading the terminal could only be ended with Ctrl-d, as SIGINT
+        // is held while a built-in runs.
+        printf("smallsh: parallel: inputs must follow ::: or come from a "
+               "file, not the terminal\n");
+        fflush(stdout);
+        return W_EXITCODE(EXIT_FAILURE, 0);
+    } else {
+        input_text = read_inputs(STDIN_FILENO, &count, &inputs);
+    }
+
+    if (pin && sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &cpus)) {
+                cpu_list[ncpus++] = cpu;
+            }
+        }
+    }
+
+    null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (null_fd == -1) {
+        printf("smallsh: parallel: cannot open /dev/null: %s\n",
+               strerror(errno));
+        fflush(stdout);
+        free(input_text);
+        if (input_text != NULL) {
+            free(inputs);
+        }
+        return W_EXITCODE(EXIT_FAILURE, 0);
+    }
+
+    struct parallel_job *job_list = calloc(count + 1, sizeof(*job_list));
+    size_t *slots = malloc(limit * sizeof(size_t));
+    long running = 0;
+    size_t next = 0, next_flush = 0;
+    int failed = 0;
+    bool interrupted = false;
+    Arena arena = new_arena();
+
+    for (size_t i = 0; i < count; i++) {
+        job_list[i].arg = inputs[i];
+        job_list[i].out_fd = -1;
+    }
+
+    while (true) {
+        // Start jobs in the free slots, assigning CPUs round-robin.
+        while (running < limit && next < count && !interrupted) {
+            int cpu = ncpus > 0 ? cpu_list[next % ncpus] : -1;
+
+            start_parallel_job(arena, template, template_argc, &job_list[next],
+                               null_fd, out_fd, mode, cpu);
+            arena_reset(arena);
+            if (job_list[next].pid > 0) {
+                slots[running++] = next;
+            } else {
+                job_list[next].done = true;
+                failed++;
+            }
+            next++;
+        }
+
+        if (running == 0) {
+            break;
+        }
+
+        wait_for_child();
+
+        // Reap this run's jobs that have finished, compacting the slots.
+        for (long slot = 0; slot < running;) {
+            struct parallel_job *job = &job_list[slots[slot]];
+            int wstatus;
+
+            if (waitpid(job->pid, &wstatus, WNOHANG) != job->pid) {
+                slot++;
+                continue;
+            }
+            TRACE(TRACE_REAP, job->pid, wstatus);
+
+            job->done = true;
+            if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+                failed++;
+            }
+            // A job killed by Ctrl-c stops further jobs from starting.
+            if (WIFSIGNALED(wstatus) && WTERMSIG(wstatus) == SIGINT) {
+                interrupted = true;
+            }
+            if (mode == OUTPUT_GROUPED) {
+                flush_job_output(job, out_fd);
+            }
+
+            slots[slot] = slots[--running];
+        }
+
+        if (mode == OUTPUT_ORDERED) {
+            while (next_flush < next && job_list[next_flush].done) {
+                flush_job_output(&job_list[next_flush++], out_fd);
+            }
+        }
+    }
+
+    // Output not yet written, of jobs that failed to start, is discarded.
+    for (size_t i = 0; i < count; i++) {
+        if (job_list[i].out_fd != -1) {
+            close(job_list[i].out_fd);
+        }
+    }
+
+    free_arena(arena);
+    free(job_list);
+    free(slots);
+    free(input_text);
+    if (input_text != NULL) {
+        free(inputs);
+    }
+    close(null_fd);
+
+    if (interrupted) {
+        return W_EXITCODE(0, SIGINT);
+    }
+    return W_EXITCODE(failed < PARALLEL_MAX_FAILED ? failed
+                                                   : PARALLEL_MAX_FAILED,
+                      0);
+}
+
+/**
+ * Writes the buffered output of job to out_fd and closes its buffer.
+ */
+void flush_job_output(struct parallel_job *job, int out_fd) {
+    struct stat sb;
+    off_t offset = 0;
+
+    if (job->out_fd == -1) {
+        return;
+    }
+
+    if (fstat(job->out_fd, &sb) == 0) {
+        while (offset < sb.st_size) {
+            if (sendfile(out_fd, job->out_fd, &offset, sb.st_size - offset) >
+                0) {
+                continue;
+            }
+
+            // Files opened for appending cannot be written by sendfile(),
+            // so copy the rest through a buffer.
+            char buf[OUTPUT_COPY_SIZE];
+            ssize_t bytes;
+            while ((bytes = pread(job->out_fd, buf, sizeof(buf), offset)) > 0 &&
+                   write(out_fd, buf, bytes) == bytes) {
+                offset += bytes;
+            }
+            break;
+        }
+    }
+
+    close(job->out_fd);
+    job->out_fd = -1;
+}
+
+/**
+ * Reads all of fd and splits it into lines, skipping empty ones, storing a
+ * newly allocated array of them in inputs and their number in count.
+ *
+ * Returns the text the lines point into, to be freed with the array.
+ */
+char *read_inputs(int fd, size_t *count, char ***inputs) {
+    size_t size = 4096, len = 0, capacity = 16;
+    char *text = malloc(size);
+    ssize_t bytes;
+
+    while ((bytes = read(fd, text + len, size - len - 1)) > 0) {
+        len += bytes;
+        if (len + 1 == size) {
+            size *= 2;
+            text = realloc(text, size);
+        }
+    }
+    text[len] = '\0';
+
+    *inputs = malloc(capacity * sizeof(char *));
+    *count = 0;
+    for (char *line = text; line < text + len;) {
+        char *end = strchr(line, '\n');
+        if (end == NULL) {
+            end = text + len;
+        }
+        *end = '\0';
+
+        if (end > line) {
+            if (*count == capacity) {
+                capacity *= 2;
+                *inputs = realloc(*inputs, capacity * sizeof(char *));
+            }
+            (*inputs)[(*count)++] = line;
+        }
+        line = end + 1;
+    }
+
+    return text;
+}
+
+/**
+ * Builds the command for job from template and starts it, storing its pid
+ * in job or -1 if it could not be started. The job reads /dev/null from
+ * null_fd and writes to out_fd, or to a memfd of its own if output is
+ * buffered. If cpu is not -1 the job is pinned to that CPU from the start,
+ * or runs unpinned with a message if it cannot be.
+ *
+ * Returns the job's pid.
+ */
+pid_t start_parallel_job(Arena arena, char **template, int template_argc,
+                         struct parallel_job *job, int null_fd, int out_fd,
+                         enum output_mode mode, int cpu) {
+    Command cmd = new_stage(arena);
+    bool substituted = false, pinned = false;
+    cpu_set_t saved_cpus;
+
+    for (int i = 0; i < template_argc; i++) {
+        if (strstr(template[i], PARALLEL_MARKER) != NULL) {
+            add_arg(arena, cmd, substitute(arena, template[i], job->arg));
+            substituted = true;
+        } else {
+            add_arg(arena, cmd, template[i]);
+        }
+    }
+    if (!substituted) {
+        add_arg(arena, cmd, job->arg);
+    }
+
+    if (mode != OUTPUT_DIRECT) {
+        job->out_fd = memfd_create("parallel", MFD_CLOEXEC);
+        if (job->out_fd == -1) {
+            perror("memfd_create()");
+        } else {
+            out_fd = job->out_fd;
+        }
+    }
+
+    // The job inherits smallsh's CPUs, so smallsh pins itself while it
+    // starts the job, which is then pinned before it execs.
+    if (cpu != -1) {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if (sched_getaffinity(0, sizeof(saved_cpus), &saved_cpus) == -1 ||
+            sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+            printf("smallsh: parallel: cannot pin job to CPU %d: %s\n", cpu,
+                   strerror(errno));
+            fflush(stdout);
+        } else {
+            pinned = true;
+        }
+    }
+
+    job->pid = spawn_command(cmd, null_fd, out_fd, -1, -1, false);
+
+    if (pinned) {
+        sched_setaffinity(0, sizeof(saved_cpus), &saved_cpus);
+    }
+
+    return job->pid;
+}
+
+/**
+ * Returns a copy of word, allocated from arena, with each {} replaced by
+ * arg.
+ */
+char *substitute(Arena arena, char *word, char *arg) {
+    size_t marker_len = strlen(PARALLEL_MARKER);
+    size_t arg_len = strlen(arg);
+    size_t size = 1;
+    char *result, *out;
+
+    // Measure the result.
+    for (char *p = word; *p != '\0';) {
+        if (strncmp(p, PARALLEL_MARKER, marker_len) == 0) {
+            size += arg_len;
+            p += marker_len;
+        } else {
+            size++;
+            p++;
+        }
+    }
+
+    result = arena_alloc(arena, size);
+    out = result;
+    for (char *p = word; *p != '\0';) {
+        if (strncmp(p, PARALLEL_MARKER, marker_len) == 0) {
+            memcpy(out, arg, arg_len);
+            out += arg_len;
+            p += marker_len;
+        } else {
+            *out++ = *p++;
+        }
+    }
+    *out = '\0';
+
+    return result;
+}
@@ -0,0 +1,20 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "processes.h"
+
+// Marker in a command template replaced by each input argument.
+#define PARALLEL_MARKER "{}"
+
+// Separator after which parallel takes its arguments from the command line.
+#define PARALLEL_ARGS_SEP ":::"
+
+// Most jobs parallel -j may run at once.
+#define PARALLEL_MAX_JOBS 65536
+
+// Highest exit value parallel reports as its count of failed jobs.
+#define PARALLEL_MAX_FAILED 101
+
+int parallel_command(char *argv[], int argc, JobTable jobs);
+
+#endif
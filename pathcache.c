@@ -0,0 +1,213 @@
+/**
+ * Cache of the locations of commands found by searching $PATH, so that a
+ * command is only searched for the first time it is run.
+ *
+ * The cache is emptied whenever $PATH differs from the value it was filled
+ * under. A cached path whose file has since disappeared is dropped by
+ * hash_forget() when exec reports it missing.
+ */
+
+#include "pathcache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The search path execvp() uses when $PATH is unset.
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+/**
+ * Hash table entry mapping a command name to the file it runs.
+ */
+struct path_entry {
+    char *name;
+    char *path;
+    int hits;
+    struct path_entry *next;
+};
+
+struct path_entry *buckets[PATH_CACHE_BUCKETS];
+
+// Value of $PATH when the cache was last filled.
+char *cached_path_var = NULL;
+
+char *search_path(char *name, char *path_var);
+
+/**
+ * FNV-1a hash of a command name, reduced to a bucket index.
+ */
+unsigned int hash_name(char *name) {
+    unsigned int hash = 2166136261u;
+
+    while (*name != '\0') {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+
+    return hash % PATH_CACHE_BUCKETS;
+}
+
+/**
+ * Removes every remembered command location.
+ */
+void hash_clear(void) {
+    for (int i = 0; i < PATH_CACHE_BUCKETS; i++) {
+        struct path_entry *entry = buckets[i];
+
+        while (entry != NULL) {
+            struct path_entry *next = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            entry = next;
+        }
+
+        buckets[i] = NULL;
+    }
+}
+
+/**
+ * Removes the remembered location of name, if there is one.
+ */
+void hash_forget(char *name) {
+    struct path_entry **link = &buckets[hash_name(name)];
+
+    while (*link != NULL) {
+        if (strcmp((*link)->name, name) == 0) {
+            struct path_entry *entry = *link;
+            *link = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            return;
+        }
+
+        link = &(*link)->next;
+    }
+}
+
+/**
+ * Returns the pathname that executing name would run.
+ *
+ * Names containing a slash are returned unchanged. Others are looked up in
+ * the cache, falling back to a search of $PATH whose result is remembered if
+ * it is an absolute path.
+ *
+ * The returned string belongs to the cache and is valid until the next call.
+ * Returns NULL if the command cannot be found.
+ */
+char *hash_lookup(char *name) {
+    char *path_var = getenv("PATH");
+    unsigned int bucket;
+
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+
+    if (path_var == NULL) {
+        path_var = DEFAULT_PATH;
+    }
+
+    // A changed $PATH may resolve any name differently.
+    if (cached_path_var == NULL || strcmp(cached_path_var, path_var) != 0) {
+        hash_clear();
+        free(cached_path_var);
+        cached_path_var = strdup(path_var);
+    }
+
+    bucket = hash_name(name);
+    for (struct path_entry *entry = buckets[bucket]; entry != NULL;
+         entry = entry->next) {
+        if (strcmp(entry->name, name) == 0) {
+            entry->hits++;
+            return entry->path;
+        }
+    }
+
+    char *found = search_path(name, path_var);
+    if (found == NULL) {
+        return NULL;
+    }
+
+    // Relative directories in $PATH depend on the working directory.
+    if (found[0] != '/') {
+        static char *uncached = NULL;
+        free(uncached);
+        uncached = found;
+        return found;
+    }
+
+    struct path_entry *entry = malloc(sizeof(struct path_entry));
+    entry->name = strdup(name);
+    entry->path = found;
+    entry->hits = 1;
+    entry->next = buckets[bucket];
+    buckets[bucket] = entry;
+
+    return entry->path;
+}
+
+/**
+ * Prints the remembered command locations and how often each was used.
+ */
+void hash_print(void) {
+    int empty = 1;
+
+    for (int i = 0; i < PATH_CACHE_BUCKETS; i++) {
+        for (struct path_entry *entry = buckets[i]; entry != NULL;
+             entry = entry->next) {
+            if (empty) {
+                printf("hits\tcommand\n");
+                empty = 0;
+            }
+            printf("%4d\t%s\n", entry->hits, entry->path);
+        }
+    }
+
+    if (empty) {
+        printf("hash table empty\n");
+    }
+    fflush(stdout);
+}
+
+/**
+ * Searches each directory of path_var in order for an executable regular
+ * file called name. An empty directory entry means the working directory.
+ *
+ * Returns a newly allocated pathname, or NULL if none is found.
+ */
+char *search_path(char *name, char *path_var) {
+    size_t name_len = strlen(name);
+    char *dir = path_var;
+    struct stat sb;
+
+    while (1) {
+        char *end = strchr(dir, ':');
+        if (end == NULL) {
+            end = dir + strlen(dir);
+        }
+        size_t dir_len = end - dir;
+        char *candidate;
+
+        if (dir_len == 0) {
+            candidate = strdup(name);
+        } else {
+            candidate = malloc(dir_len + name_len + 2);
+            memcpy(candidate, dir, dir_len);
+            candidate[dir_len] = '/';
+            memcpy(candidate + dir_len + 1, name, name_len + 1);
+        }
+
+        if (stat(candidate, &sb) == 0 && S_ISREG(sb.st_mode) &&
+            access(candidate, X_OK) == 0) {
+            return candidate;
+        }
+        free(candidate);
+
+        if (*end == '\0') {
+            return NULL;
+        }
+        dir = end + 1;
+    }
+}
@@ -0,0 +1,12 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+// Number of buckets in the table of remembered command locations.
+#define PATH_CACHE_BUCKETS 256
+
+void hash_clear(void);
+void hash_forget(char *name);
+char *hash_lookup(char *name);
+void hash_print(void);
+
+#endif
@@ -0,0 +1,437 @@
+/**
+ * Placement of background jobs on CPUs, and their CPU and I/O priority, as
+ * set with the place built-in, so that background work does not compete
+ * with foreground commands.
+ *
+ * Usage:
+ *  place               show the placement
+ *  place [-c CPUS] [-n NICE] [-i CLASS[:LEVEL]] [-f CPUS]
+ *  place -r            go back to placing nothing
+ *
+ * Options:
+ *  -c CPUS : pin each background job to one of CPUS, taken round-robin
+ *  -n NICE : run background jobs at niceness NICE
+ *  -i CLASS[:LEVEL] : run background jobs in the I/O scheduling class
+ *      idle, be (best effort) or rt (real time), at LEVEL 0 to 7
+ *  -f CPUS : reserve CPUS for the shell and its foreground commands, which
+ *      background jobs do not run on
+ *
+ * CPUS is a list such as 0-3,8. Any option given none removes its setting.
+ *
+ * posix_spawn() cannot apply these settings, so while any is set background
+ * jobs are started with fork() instead, and each of their processes applies
+ * them to itself before exec, so that nothing a job runs starts unplaced.
+ * place first tries the niceness and I/O priority in a child, reporting
+ * those smallsh lacks the privilege for rather than letting every job fail
+ * to apply them. Reserving CPUs pins smallsh itself, so foreground commands
+ * inherit them with nothing to apply. Without -c, background jobs may use
+ * every CPU the shell could before that are not reserved.
+ */
+
+#define _GNU_SOURCE
+#include "placement.h"
+#include "builtins.h"
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Where and how background jobs run.
+ *
+ * Fields:
+ * cpus : the CPUs given with -c, taken round-robin, or empty for none
+ * reserved : the CPUs given with -f, or empty for none
+ * nice, has_nice : the niceness given with -n, if any
+ * ioprio_class, ioprio_level : the I/O priority given with -i
+ */
+struct placement {
+    cpu_set_t cpus;
+    cpu_set_t reserved;
+    int nice;
+    bool has_nice;
+    enum ioprio_class ioprio_class;
+    int ioprio_level;
+};
+
+// The placement in effect.
+struct placement placement;
+
+// The CPUs smallsh could run on before it reserved any, kept while it has.
+cpu_set_t shell_cpus;
+
+// The CPU of placement.cpus that the next job is pinned to.
+int next_cpu = 0;
+
+// The CPUs that the processes of the job being started pin themselves to,
+// as chosen by next_placement(), and whether they do.
+cpu_set_t job_cpus;
+bool job_pinned = false;
+
+char *ioprio_names[] = {"none", "rt", "be", "idle"};
+
+void allowed_cpus(cpu_set_t *cpus);
+int parse_cpus(char *text, cpu_set_t *cpus);
+int parse_ioprio(char *text, struct placement *place);
+void print_cpus(cpu_set_t *cpus);
+void print_placement(void);
+int probe_placement(struct placement *place);
+int set_placement(struct placement *place, cpu_set_t *cpus);
+
+/**
+ * Stores in cpus the CPUs that placed work may use: those smallsh could run
+ * on before reserving any.
+ */
+void allowed_cpus(cpu_set_t *cpus) {
+    if (CPU_COUNT(&placement.reserved) > 0) {
+        *cpus = shell_cpus;
+    } else if (sched_getaffinity(0, sizeof(*cpus), cpus) == -1) {
+        CPU_ZERO(cpus);
+    }
+}
+
+/**
+ * Places the calling process, a child of a background job between fork()
+ * and exec, as the placement and next_placement() say. A failure is
+ * reported on stderr, which is the job's, and the job runs unplaced.
+ */
+void apply_placement(void) {
+    if (set_placement(&placement, job_pinned ? &job_cpus : NULL) == -1) {
+        fprintf(stderr, "smallsh: place: cannot place job: %s\n",
+                strerror(errno));
+    }
+}
+
+/**
+ * Chooses the CPUs of the background job about to start: the next CPU of
+ * placement.cpus, taken round-robin, so that all its processes share it, or
+ * else every CPU that is not reserved.
+ */
+void next_placement(void) {
+    job_pinned = true;
+
+    if (CPU_COUNT(&placement.cpus) > 0) {
+        // Take the next CPU of the set after the last one used.
+        int skipped = 0, cpu = 0;
+
+        for (; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &placement.cpus) && skipped++ == next_cpu) {
+                break;
+            }
+        }
+        next_cpu = (next_cpu + 1) % CPU_COUNT(&placement.cpus);
+        CPU_ZERO(&job_cpus);
+        CPU_SET(cpu, &job_cpus);
+    } else if (CPU_COUNT(&placement.reserved) > 0) {
+        // Anywhere but the reserved CPUs.
+        CPU_XOR(&job_cpus, &shell_cpus, &placement.reserved);
+    } else {
+        job_pinned = false;
+    }
+}
+
+/**
+ * Parses text, a list of CPUs and ranges of CPUs such as 0-3,8, or none for
+ * no CPUs, into cpus.
+ *
+ * Returns 0 if successful, -1 if text is not such a list.
+ */
+int parse_cpus(char *text, cpu_set_t *cpus) {
+    char *end;
+    long first, last;
+
+    CPU_ZERO(cpus);
+    if (strcmp(text, "none") == 0) {
+        return 0;
+    }
+
+    while (true) {
+        first = strtol(text, &end, 10);
+        if (end == text || first < 0 || first >= CPU_SETSIZE) {
+            return -1;
+        }
+        last = first;
+        if (*end == '-') {
+            text = end + 1;
+            last = strtol(text, &end, 10);
+            if (end == text || last < first || last >= CPU_SETSIZE) {
+                return -1;
+            }
+        }
+
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+
+        if (*end == '\0') {
+            return 0;
+        }
+        if (*end != ',') {
+            return -1;
+        }
+        text = end + 1;
+    }
+}
+
+/**
+ * Parses text, an I/O scheduling class optionally followed by a colon and a
+ * level, or none, into place.
+ *
+ * Returns 0 if successful, -1 if not.
+ */
+int parse_ioprio(char *text, struct placement *place) {
+    char *colon = strchr(text, ':');
+    size_t name_length = colon != NULL ? (size_t)(colon - text) : strlen(text);
+    char *end;
+
+    place->ioprio_level = IOPRIO_DEFAULT_LEVEL;
+    for (int class = IOPRIO_NONE; class <= IOPRIO_IDLE; class++) {
+        if (strlen(ioprio_names[class]) != name_length ||
+            strncmp(text, ioprio_names[class], name_length) != 0) {
+            continue;
+        }
+        place->ioprio_class = class;
+
+        // Only the real-time and best-effort classes have levels.
+        if (colon == NULL) {
+            return 0;
+        }
+        if (class != IOPRIO_RT && class != IOPRIO_BE) {
+            return -1;
+        }
+        place->ioprio_level = strtol(colon + 1, &end, 10);
+        if (end == colon + 1 || *end != '\0' || place->ioprio_level < 0 ||
+            place->ioprio_level > 7) {
+            return -1;
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+/**
+ * Shows the placement, or changes it, reporting errors without changing
+ * anything.
+ */
+int place_command(char *argv[], int argc, JobTable jobs) {
+    struct placement place = placement;
+    cpu_set_t allowed, overlap;
+    char *end;
+    long value;
+
+    if (argc == 1) {
+        print_placement();
+        return NO_STATUS;
+    }
+
+    if (argc == 2 && strcmp(argv[1], "-r") == 0) {
+        memset(&place, 0, sizeof(place));
+    } else {
+        for (int i = 1; i < argc; i += 2) {
+            char *option = argv[i], *arg = i + 1 < argc ? argv[i + 1] : NULL;
+
+            if (arg == NULL || option[0] != '-' || strlen(option) != 2 ||
+                strchr("cnif", option[1]) == NULL) {
+                printf("smallsh: place: usage: place [-c CPUS] [-n NICE] "
+                       "[-i CLASS[:LEVEL]] [-f CPUS] | -r\n");
+                fflush(stdout);
+                return NO_STATUS;
+            }
+
+            if ((option[1] == 'c' && parse_cpus(arg, &place.cpus) == -1) ||
+                (option[1] == 'f' && parse_cpus(arg, &place.reserved) == -1)) {
+                printf("smallsh: place: %s: invalid CPU list\n", arg);
+                fflush(stdout);
+                return NO_STATUS;
+            }
+
+            if (option[1] == 'i' && parse_ioprio(arg, &place) == -1) {
+                printf("smallsh: place: %s: invalid I/O class\n", arg);
+                fflush(stdout);
+                return NO_STATUS;
+            }
+
+            if (option[1] == 'n') {
+                place.has_nice = strcmp(arg, "none") != 0;
+                value = strtol(arg, &end, 10);
+                if (place.has_nice && (*end != '\0' || end == arg ||
+                                       value < -20 || value > 19)) {
+                    printf("smallsh: place: %s: invalid niceness\n", arg);
+                    fflush(stdout);
+                    return NO_STATUS;
+                }
+                place.nice = value;
+            }
+        }
+    }
+
+    // Every CPU must be one smallsh may use, and the background and
+    // foreground each need one of their own.
+    allowed_cpus(&allowed);
+    CPU_OR(&overlap, &place.cpus, &place.reserved);
+    CPU_AND(&overlap, &overlap, &allowed);
+    if (CPU_COUNT(&overlap) !=
+        CPU_COUNT(&place.cpus) + CPU_COUNT(&place.reserved)) {
+        printf("smallsh: place: CPUs must be available and not both "
+               "reserved and given to -c\n");
+        fflush(stdout);
+        return NO_STATUS;
+    }
+    if (CPU_COUNT(&place.reserved) > 0 &&
+        CPU_COUNT(&place.reserved) == CPU_COUNT(&allowed)) {
+        printf("smallsh: place: no CPUs left for background jobs\n");
+        fflush(stdout);
+        return NO_STATUS;
+    }
+
+    errno = probe_placement(&place);
+    if (errno != 0) {
+        printf("smallsh: place: cannot set niceness or I/O class: %s\n",
+               strerror(errno));
+        fflush(stdout);
+        return NO_STATUS;
+    }
+
+    // Move smallsh onto its reserved CPUs, or back to where it could run.
+    if (CPU_COUNT(&place.reserved) > 0) {
+        if (CPU_COUNT(&placement.reserved) == 0) {
+            shell_cpus = allowed;
+        }
+        if (sched_setaffinity(0, sizeof(place.reserved), &place.reserved) ==
+            -1) {
+            perror("smallsh: place: sched_setaffinity()");
+            return NO_STATUS;
+        }
+    } else if (CPU_COUNT(&placement.reserved) > 0) {
+        sched_setaffinity(0, sizeof(shell_cpus), &shell_cpus);
+    }
+
+    placement = place;
+    next_cpu = 0;
+
+    return NO_STATUS;
+}
+
+/**
+ * Returns whether background jobs are placed, and so must apply the
+ * placement to themselves as they start.
+ */
+bool placing(void) {
+    return CPU_COUNT(&placement.cpus) > 0 ||
+           CPU_COUNT(&placement.reserved) > 0 || placement.has_nice ||
+           placement.ioprio_class != IOPRIO_NONE;
+}
+
+/**
+ * Prints cpus as a list of CPUs and ranges, such as 0-3,8.
+ */
+void print_cpus(cpu_set_t *cpus) {
+    bool first = true;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        int last = cpu;
+
+        if (!CPU_ISSET(cpu, cpus)) {
+            continue;
+        }
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, cpus)) {
+            last++;
+        }
+
+        printf(first ? "%d" : ",%d", cpu);
+        if (last > cpu) {
+            printf("-%d", last);
+        }
+        first = false;
+        cpu = last;
+    }
+}
+
+/**
+ * Prints the placement as the place command that sets it.
+ */
+void print_placement(void) {
+    if (!placing()) {
+        printf("placement none\n");
+        fflush(stdout);
+        return;
+    }
+
+    printf("place");
+    if (CPU_COUNT(&placement.cpus) > 0) {
+        printf(" -c ");
+        print_cpus(&placement.cpus);
+    }
+    if (placement.has_nice) {
+        printf(" -n %d", placement.nice);
+    }
+    if (placement.ioprio_class == IOPRIO_IDLE) {
+        printf(" -i idle");
+    } else if (placement.ioprio_class != IOPRIO_NONE) {
+        printf(" -i %s:%d", ioprio_names[placement.ioprio_class],
+               placement.ioprio_level);
+    }
+    if (CPU_COUNT(&placement.reserved) > 0) {
+        printf(" -f ");
+        print_cpus(&placement.reserved);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+/**
+ * Tries the niceness and I/O priority of place in a child process, which
+ * applies them to itself as a job would.
+ *
+ * Returns 0 if they can be set, else the errno of the failure.
+ */
+int probe_placement(struct placement *place) {
+    int wstatus;
+    pid_t pid;
+
+    if (!place->has_nice && place->ioprio_class == IOPRIO_NONE) {
+        return 0;
+    }
+
+    pid = fork();
+    if (pid == -1) {
+        return errno;
+    }
+    if (pid == 0) {
+        _exit(set_placement(place, NULL) == -1 ? errno : 0);
+    }
+
+    if (waitpid(pid, &wstatus, 0) == -1) {
+        return errno;
+    }
+    return WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : ECHILD;
+}
+
+/**
+ * Applies place to the calling process, pinning it to cpus unless that is
+ * NULL.
+ *
+ * Returns 0 if successful, -1 with errno set if not.
+ */
+int set_placement(struct placement *place, cpu_set_t *cpus) {
+    int ioprio = place->ioprio_class << IOPRIO_CLASS_SHIFT |
+                 place->ioprio_level;
+
+    if ((cpus != NULL && sched_setaffinity(0, sizeof(*cpus), cpus) == -1) ||
+        (place->has_nice &&
+         setpriority(PRIO_PROCESS, 0, place->nice) == -1) ||
+        (place->ioprio_class != IOPRIO_NONE &&
+         syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) == -1)) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include "processes.h"
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Fields of an I/O priority, as ioprio_set() takes it.
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+enum ioprio_class { IOPRIO_NONE, IOPRIO_RT, IOPRIO_BE, IOPRIO_IDLE };
+
+// Level of the real-time and best-effort classes when none is given.
+#define IOPRIO_DEFAULT_LEVEL 4
+
+void apply_placement(void);
+void next_placement(void);
+int place_command(char *argv[], int argc, JobTable jobs);
+bool placing(void);
+
+#endif
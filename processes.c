@@ -1,139 +1,791 @@
 /**
  * Implementation of data structure to track processes running in the
  * background.
+ *
+ * Jobs are kept in an open-addressing hash table keyed by pid, with linear
+ * probing and backward-shift deletion, so lookups and removals take constant
+ * time however many jobs are running. Job entries come from slabs of
+ * JOB_SLAB_SIZE and are recycled through a free list, so starting and
+ * reaping jobs does not allocate once the pool has grown.
  */
 
 #include "processes.h"
 #include "builtins.h"
+#include "capture.h"
+#include "commands.h"
+#include "events.h"
+#include "trace.h"
+#include <errno.h>
+#include <poll.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
-void term_proc(pid_t pid);
+/**
+ * A background command waiting for a running job to finish, with what it
+ * was given by background_command().
+ */
+struct queued_job {
+    struct command_entry *cmd;
+    JobNotify notify;
+    void *notify_data;
+    int out_fd;
+    struct queued_job *next;
+};
 
 /**
- * Linked list struct to store information about processes running in the
- * background of smallsh.
+ * A block of job entries for the pool.
  */
-struct process {
-    pid_t pid;
-    struct process *next;
+struct job_slab {
+    struct job_slab *next;
+    struct process entries[JOB_SLAB_SIZE];
 };
 
 /**
- * Creates a new process struct and adds it to the head of the list.
+ * Hash table of background jobs.
+ *
+ * Fields:
+ * slots : array of capacity entries, NULL where unused
+ * capacity : number of slots, a power of two at least twice count
+ * count : number of jobs in the table
+ * free_list : entries available for new jobs
+ * slabs : every slab allocated for the pool
+ * next_job_id : job id to give the next job
+ * running : number of jobs started and not yet reported done
+ * limit : most jobs to run at once, or 0 for no limit
+ * queue_head, queue_tail : commands waiting for a job to finish, in order
+ * queued : number of commands waiting
+ * timer_fd : timerfd set to expire at the earliest deadline of any job
+ * next_deadline : the time timer_fd is set for, or 0 when it is disarmed
+ * exit_grace : seconds kill_all() gives jobs to exit after SIGTERM
  */
-Process add_proc(Process head, pid_t pid) {
-    Process new_proc = malloc(sizeof(struct process));
-    new_proc->pid = pid;
-    new_proc->next = head;
+struct job_table {
+    Process *slots;
+    size_t capacity;
+    size_t count;
+    Process free_list;
+    struct job_slab *slabs;
+    int next_job_id;
+    int running;
+    int limit;
+    struct queued_job *queue_head;
+    struct queued_job *queue_tail;
+    int queued;
+    int timer_fd;
+    double next_deadline;
+    double exit_grace;
+};
+
+void arm_timer(JobTable jobs, double deadline);
+void grow_table(JobTable jobs);
+Process insert_entry(JobTable jobs, pid_t pid);
+size_t slot_of(JobTable jobs, pid_t pid);
+void reap_all(JobTable jobs);
+
+/**
+ * Takes an entry from the pool for a new job and adds it to the table.
+ *
+ * Returns the new entry.
+ */
+Process add_proc(JobTable jobs, pid_t pid, pid_t pgid, char *cmdline) {
+    Process new_proc = insert_entry(jobs, pid);
+
+    jobs->running++;
+    new_proc->pgid = pgid;
+    new_proc->job_id = jobs->next_job_id++;
+    new_proc->state = JOB_RUNNING;
+    new_proc->job = new_proc;
+    new_proc->stages_left = 1;
+    new_proc->wstatus = 0;
+    memset(&new_proc->usage, 0, sizeof(new_proc->usage));
+    clock_gettime(CLOCK_MONOTONIC, &new_proc->start);
+    snprintf(new_proc->cmdline, JOB_CMD_LENGTH, "%s", cmdline);
+
+    return new_proc;
+}
+
+/**
+ * Adds pid to the table as an earlier pipeline stage of job, which is
+ * reported once all of its stages have been reaped.
+ *
+ * Returns the new entry.
+ */
+Process add_stage(JobTable jobs, pid_t pid, Process job) {
+    Process new_proc = insert_entry(jobs, pid);
+
+    new_proc->pgid = job->pgid;
+    new_proc->job_id = job->job_id;
+    new_proc->state = JOB_RUNNING;
+    new_proc->job = job;
+    new_proc->start = job->start;
+    new_proc->cmdline[0] = '\0';
+    job->stages_left++;
 
     return new_proc;
 }
 
 /**
- * Checks for any terminated background process. If one is found, then prints
- * its pid and status to the console and removes it from the Process list.
+ * Sets the job table's timer to expire at deadline, or disarms it if
+ * deadline is 0.
  */
-Process check_bg_processes(Process head) {
-    int wstatus;
+void arm_timer(JobTable jobs, double deadline) {
+    struct itimerspec when = {{0, 0}, {0, 0}};
+
+    if (deadline > 0) {
+        when.it_value.tv_sec = deadline;
+        when.it_value.tv_nsec = (deadline - when.it_value.tv_sec) * 1e9;
+        // A zero it_value would disarm the timer instead.
+        if (when.it_value.tv_sec == 0 && when.it_value.tv_nsec == 0) {
+            when.it_value.tv_nsec = 1;
+        }
+    }
+
+    jobs->next_deadline = deadline;
+    if (jobs->timer_fd != -1) {
+        timerfd_settime(jobs->timer_fd, TFD_TIMER_ABSTIME, &when, NULL);
+    }
+}
+
+/**
+ * Checks for terminated background processes. Each one found is reaped and
+ * its resource use is added to its job. Once every process of a job has been
+ * reaped, the job's pid, status and resource use are printed to the console
+ * in the order jobs finish, or passed to its notify callback if it has one,
+ * and it is removed from the job table.
+ *
+ * Foreground children have always been waited for by the time this runs, so
+ * every child it reaps belongs to a background job.
+ *
+ * Queued commands are then started in the room that finished jobs leave.
+ *
+ * If at_prompt, a prompt has been printed, so reports start on a new line.
+ * Returns the number of jobs reported.
+ */
+int check_bg_processes(JobTable jobs, bool at_prompt) {
+    struct rusage usage;
+    int wstatus, reported = 0;
     pid_t child_pid;
+    Process proc, job;
+
+    while ((child_pid = wait4(-1, &wstatus, WNOHANG, &usage)) > 0) {
+        TRACE(TRACE_REAP, child_pid, wstatus);
+
+        proc = find_proc(jobs, child_pid);
+        if (proc == NULL) {
+            continue;
+        }
 
-    child_pid = waitpid(-1, &wstatus, WNOHANG);
+        job = proc->job;
+        proc->state = JOB_DONE;
+        add_usage(&job->usage, &usage);
+
+        if (proc == job) {
+            // The last stage decides the status of a pipeline.
+            job->wstatus = wstatus;
+        } else {
+            rm_proc(jobs, child_pid);
+        }
+
+        if (--job->stages_left > 0) {
+            continue;
+        }
+
+        if (job->capture != NULL) {
+            finish_capture(job->capture);
+        }
 
-    // Print message re terminating background process before prompt.
-    if (child_pid > 0) {
         // Update smallsh status with bg process.
-        update_status(wstatus);
+        if (job->timed_out) {
+            timeout_status(job->wstatus);
+        } else {
+            update_status(job->wstatus);
+        }
+
+        if (job->notify != NULL) {
+            job->notify(job, job->notify_data);
+            rm_proc(jobs, job->pid);
+            jobs->running--;
+            continue;
+        }
 
-        printf("background pid %d is done: ", child_pid);
+        // Print message re terminating background process before prompt,
+        // leaving the line of a prompt already shown.
+        if (at_prompt && reported++ == 0) {
+            printf("\n");
+        }
+        printf("background pid %d is done: ", job->pid);
         print_status();
+        printf("  ");
+        print_usage(&job->start, &job->usage);
+
+        // Remove job's pid from the job table.
+        rm_proc(jobs, job->pid);
+        jobs->running--;
+    }
+
+    // Finished jobs make room for queued ones.
+    start_queued_jobs(jobs);
+
+    return reported;
+}
+
+/**
+ * Signals the jobs whose deadlines have passed, then sets the timer for the
+ * next deadline. A job past its time limit is sent SIGTERM, then SIGKILL if
+ * it is still running once its grace period is over too.
+ *
+ * Finding the deadlines takes a pass over the table, but only when one has
+ * passed, not per job started or reaped.
+ */
+void expire_jobs(JobTable jobs) {
+    double now = monotonic_time(), next = 0;
+    uint64_t expirations;
+    size_t pos = 0;
+    Process proc;
+
+    if (jobs->timer_fd != -1) {
+        read(jobs->timer_fd, &expirations, sizeof(expirations));
+    }
+    if (jobs->next_deadline == 0 || jobs->next_deadline > now) {
+        return;
+    }
 
-        // Remove process's pid from the Process list.
-        head = rm_proc(head, child_pid);
+    while ((proc = iter_procs(jobs, &pos)) != NULL) {
+        // Only a job's own entry holds its deadline, not its earlier stages.
+        if (proc->job != proc || proc->deadline == 0) {
+            continue;
+        }
+
+        if (proc->deadline <= now) {
+            if (!proc->timed_out) {
+                kill(-proc->pgid, SIGTERM);
+                proc->timed_out = true;
+                proc->deadline = proc->grace > 0 ? now + proc->grace : 0;
+            } else {
+                kill(-proc->pgid, SIGKILL);
+                proc->deadline = 0;
+            }
+        }
+
+        if (proc->deadline > 0 && (next == 0 || proc->deadline < next)) {
+            next = proc->deadline;
+        }
     }
 
-    return head;
+    arm_timer(jobs, next);
 }
 
 /**
- * Traverses the list of processes for a matching pid, returning a pointer to
- * the process struct. Returns NULL if not found.
+ * Returns whether any job has a deadline still to come.
  */
-Process find_proc(Process head, pid_t pid) {
-    while (head != NULL) {
-        if (head->pid == pid) {
-            return head;
+bool has_deadlines(JobTable jobs) {
+    return jobs->next_deadline != 0;
+}
+
+/**
+ * Looks up the job whose pid is pid. Returns NULL if not found.
+ */
+Process find_proc(JobTable jobs, pid_t pid) {
+    for (size_t slot = slot_of(jobs, pid); jobs->slots[slot] != NULL;
+         slot = (slot + 1) & (jobs->capacity - 1)) {
+        if (jobs->slots[slot]->pid == pid) {
+            return jobs->slots[slot];
         }
+    }
+
+    return NULL;
+}
 
-        head = head->next;
+/**
+ * Doubles the number of slots in the table, reinserting every job.
+ */
+void grow_table(JobTable jobs) {
+    Process *old_slots = jobs->slots;
+    size_t old_capacity = jobs->capacity;
+
+    jobs->capacity *= 2;
+    jobs->slots = calloc(jobs->capacity, sizeof(Process));
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i] != NULL) {
+            size_t slot = slot_of(jobs, old_slots[i]->pid);
+            while (jobs->slots[slot] != NULL) {
+                slot = (slot + 1) & (jobs->capacity - 1);
+            }
+            jobs->slots[slot] = old_slots[i];
+        }
+    }
+
+    free(old_slots);
+}
+
+/**
+ * Takes an entry from the pool and adds it to the table under pid, growing
+ * the pool and the table as needed.
+ *
+ * Returns the entry, of which pid is set and the time limit, capture and
+ * notification cleared, since the entry may have been used by an earlier job.
+ */
+Process insert_entry(JobTable jobs, pid_t pid) {
+    Process new_proc;
+    size_t slot;
+
+    if (jobs->free_list == NULL) {
+        struct job_slab *slab = malloc(sizeof(struct job_slab));
+
+        // Thread the slab's entries onto the free list.
+        for (int i = 0; i < JOB_SLAB_SIZE - 1; i++) {
+            slab->entries[i].next_free = &slab->entries[i + 1];
+        }
+        slab->entries[JOB_SLAB_SIZE - 1].next_free = NULL;
+
+        jobs->free_list = slab->entries;
+        slab->next = jobs->slabs;
+        jobs->slabs = slab;
+    }
+
+    // Keep the table at most half full.
+    if ((jobs->count + 1) * 2 > jobs->capacity) {
+        grow_table(jobs);
+    }
+
+    new_proc = jobs->free_list;
+    jobs->free_list = new_proc->next_free;
+    new_proc->next_free = NULL;
+    new_proc->pid = pid;
+    new_proc->deadline = 0;
+    new_proc->grace = 0;
+    new_proc->timed_out = false;
+    new_proc->capture = NULL;
+    new_proc->notify = NULL;
+    new_proc->notify_data = NULL;
+
+    for (slot = slot_of(jobs, pid); jobs->slots[slot] != NULL;
+         slot = (slot + 1) & (jobs->capacity - 1)) {
+    }
+    jobs->slots[slot] = new_proc;
+    jobs->count++;
+
+    return new_proc;
+}
+
+/**
+ * Iterates over the entries in the table, in no particular order, including
+ * those for the earlier stages of pipelines. pos should
+ * be 0 for the first call and is advanced by each call. The table must not
+ * be changed during the iteration.
+ *
+ * Returns the next job, or NULL when there are no more.
+ */
+Process iter_procs(JobTable jobs, size_t *pos) {
+    while (*pos < jobs->capacity) {
+        Process proc = jobs->slots[(*pos)++];
+        if (proc != NULL) {
+            return proc;
+        }
     }
 
     return NULL;
 }
 
 /**
- * Traverses the list of processes, terminating the processes and freeing the
- * memory allocated for their structs.
+ * Returns whether another background job may start without exceeding the
+ * concurrency limit.
+ */
+bool job_slot_free(JobTable jobs) {
+    return jobs->limit == 0 || jobs->running < jobs->limit;
+}
+
+/**
+ * Returns the most background jobs that may run at once, 0 for no limit.
+ */
+int job_limit(JobTable jobs) {
+    return jobs->limit;
+}
+
+/**
+ * Returns the timerfd that expires when a job's deadline passes, for which
+ * expire_jobs() should then be called, or -1 if there is none.
+ */
+int job_timer_fd(JobTable jobs) {
+    return jobs->timer_fd;
+}
+
+/**
+ * Returns the seconds kill_all() gives jobs to exit before killing them.
+ */
+double exit_grace(JobTable jobs) {
+    return jobs->exit_grace;
+}
+
+/**
+ * Discards queued commands and terminates every job in the table.
+ *
+ * The process group of every job is sent SIGTERM at once, and then the jobs
+ * are waited for together, each process through a pidfd, until every group
+ * is gone or the table's exit grace period is over. The groups still
+ * present then, including any processes a job left behind, are sent
+ * SIGKILL, and their number is printed. Shutting down takes at most the
+ * grace period however many jobs there are.
+ *
+ * Every job is removed from the table.
  */
-void kill_all(Process head) {
-    while (head != NULL) {
-        term_proc(head->pid);
-        head = head->next;
+void kill_all(JobTable jobs) {
+    struct pollfd *fds = malloc((jobs->count + 1) * sizeof(struct pollfd));
+    pid_t *groups = malloc((jobs->count + 1) * sizeof(pid_t));
+    double deadline = monotonic_time() + jobs->exit_grace;
+    int nfds = 0, ngroups = 0, alive, forced = 0;
+    size_t pos = 0;
+    Process proc;
+
+    // Commands that have not started are dropped.
+    while (jobs->queue_head != NULL) {
+        struct queued_job *next = jobs->queue_head->next;
+        free(jobs->queue_head->cmd);
+        free(jobs->queue_head);
+        jobs->queue_head = next;
+    }
+    jobs->queue_tail = NULL;
+    jobs->queued = 0;
+
+    while ((proc = iter_procs(jobs, &pos)) != NULL) {
+        // The process group is shared by all stages of a pipeline.
+        if (proc->job == proc) {
+            groups[ngroups++] = proc->pgid;
+            if (kill(-proc->pgid, SIGTERM) == -1 && errno != ESRCH) {
+                perror("kill()");
+            }
+        }
+
+        // Without a pidfd, as before Linux 5.3, the process is checked for
+        // every few milliseconds instead. A reaped stage is not watched.
+        fds[nfds].fd = proc->state == JOB_RUNNING
+                           ? syscall(SYS_pidfd_open, proc->pid, 0)
+                           : -2;
+        fds[nfds++].events = POLLIN;
+    }
+
+    while (true) {
+        bool unwatched = jobs->count == 0;
+        double now = monotonic_time();
+        int timeout;
+
+        reap_all(jobs);
+        alive = 0;
+        for (int i = 0; i < ngroups; i++) {
+            if (groups[i] != 0 && kill(-groups[i], 0) == 0) {
+                alive++;
+            } else {
+                groups[i] = 0;
+            }
+        }
+        if (alive == 0 || now >= deadline) {
+            break;
+        }
+
+        // A pidfd stays readable once its process has exited, so it is
+        // closed rather than polled again. Negative descriptors are skipped.
+        for (int i = 0; i < nfds; i++) {
+            if (fds[i].fd >= 0 && (fds[i].revents & POLLIN)) {
+                close(fds[i].fd);
+                fds[i].fd = -2;
+            }
+            fds[i].revents = 0;
+            if (fds[i].fd == -1) {
+                unwatched = true;
+            }
+        }
+
+        // Processes left behind by a job have no pidfd either.
+        timeout = (deadline - now) * 1000 + 1;
+        if (unwatched && timeout > 10) {
+            timeout = 10;
+        }
+        if (poll(fds, nfds, timeout) == -1 && errno != EINTR) {
+            perror("poll()");
+            break;
+        }
+    }
+
+    for (int i = 0; i < ngroups; i++) {
+        if (groups[i] != 0 && kill(-groups[i], SIGKILL) == 0) {
+            forced++;
+        }
+    }
+    if (forced > 0) {
+        printf("%d background job%s still running after %gs, killed\n",
+               forced, forced == 1 ? "" : "s", jobs->exit_grace);
+        fflush(stdout);
+    }
+
+    for (int i = 0; i < nfds; i++) {
+        if (fds[i].fd >= 0) {
+            close(fds[i].fd);
+        }
+    }
+    free(fds);
+    free(groups);
+
+    // Forget the jobs that were killed without waiting for them. Removal
+    // may shift entries back, so each search starts over.
+    while (jobs->count > 0) {
+        pos = 0;
+        proc = iter_procs(jobs, &pos);
+        rm_proc(jobs, proc->pid);
+    }
+    jobs->running = 0;
+}
+
+/**
+ * Returns the time of CLOCK_MONOTONIC in seconds.
+ */
+double monotonic_time(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Creates an empty job table, limited to one running job per online CPU.
+ */
+JobTable new_job_table(void) {
+    JobTable jobs = calloc(1, sizeof(struct job_table));
+
+    jobs->capacity = JOB_TABLE_SLOTS;
+    jobs->slots = calloc(jobs->capacity, sizeof(Process));
+    jobs->next_job_id = 1;
+    jobs->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    jobs->exit_grace = EXIT_GRACE;
+
+    // By default run as many jobs at once as there are CPUs.
+    jobs->limit = sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs->limit < 1) {
+        jobs->limit = 1;
+    }
+
+    return jobs;
+}
+
+/**
+ * Prints each running job with its job id, pid, running time and command
+ * line, in the order they were started, followed by the queued commands.
+ */
+void print_jobs(JobTable jobs) {
+    Process sorted[jobs->running > 0 ? jobs->running : 1];
+    struct timespec now;
+    size_t pos = 0;
+    int count = 0;
+    char cmdline[JOB_CMD_LENGTH];
+    Process proc;
+
+    while ((proc = iter_procs(jobs, &pos)) != NULL) {
+        if (proc->job == proc && count < jobs->running) {
+            sorted[count++] = proc;
+        }
     }
+
+    // Job ids increase, so an insertion sort by id restores start order.
+    for (int i = 1; i < count; i++) {
+        Process key = sorted[i];
+        int j = i - 1;
+        for (; j >= 0 && sorted[j]->job_id > key->job_id; j--) {
+            sorted[j + 1] = sorted[j];
+        }
+        sorted[j + 1] = key;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (int i = 0; i < count; i++) {
+        proc = sorted[i];
+        printf("[%d] %d %s %.1fs %s\n", proc->job_id, proc->pid,
+               proc->timed_out              ? "timed out"
+               : proc->state == JOB_RUNNING ? "running"
+                                            : "done",
+               (now.tv_sec - proc->start.tv_sec) +
+                   (now.tv_nsec - proc->start.tv_nsec) / 1e9,
+               proc->cmdline);
+    }
+
+    for (struct queued_job *queued = jobs->queue_head; queued != NULL;
+         queued = queued->next) {
+        format_command(queued->cmd, cmdline, sizeof(cmdline));
+        printf("[-] queued %s\n", cmdline);
+    }
+    fflush(stdout);
 }
 
 /**
- * Removes the process with pid from the list if it exists, returning the head
- * of the list.
+ * Adds cmd, a heap copy from copy_command(), to the end of the queue of
+ * background commands waiting to start, to be started with notify, data and
+ * out_fd as by background_command(). The queue takes ownership of cmd.
+ *
+ * Returns the number of commands waiting.
  */
-Process rm_proc(Process head, pid_t pid) {
-    int kill_result;
+int queue_job(JobTable jobs, struct command_entry *cmd, JobNotify notify,
+              void *data, int out_fd) {
+    struct queued_job *queued = malloc(sizeof(struct queued_job));
 
-    // Check whether the head is the process.
-    if (head->pid == pid) {
-        return head->next;
+    queued->cmd = cmd;
+    queued->notify = notify;
+    queued->notify_data = data;
+    queued->out_fd = out_fd;
+    queued->next = NULL;
+
+    if (jobs->queue_tail == NULL) {
+        jobs->queue_head = queued;
+    } else {
+        jobs->queue_tail->next = queued;
     }
+    jobs->queue_tail = queued;
+
+    return ++jobs->queued;
+}
 
-    Process ptr = head;
+/**
+ * Removes the job with pid from the table if it exists, returning its entry
+ * to the pool. The process itself is not signaled.
+ */
+void rm_proc(JobTable jobs, pid_t pid) {
+    size_t mask = jobs->capacity - 1;
+    size_t slot = slot_of(jobs, pid);
+    Process proc;
 
-    while (ptr->next != NULL) {
-        if (ptr->next->pid == pid) {
-            // Terminate the process.
-            term_proc(pid);
+    while ((proc = jobs->slots[slot]) != NULL && proc->pid != pid) {
+        slot = (slot + 1) & mask;
+    }
 
-            // Remove the process struct from the list.
-            Process tmp = ptr->next;
-            ptr->next = ptr->next->next;
+    if (proc == NULL) {
+        return;
+    }
 
-            // Remove it from the heap.
-            free(tmp);
+    // Shift later entries of the probe sequence back into the gap, so that
+    // no lookup stops early at an empty slot.
+    size_t gap = slot;
+    for (size_t next = (gap + 1) & mask; jobs->slots[next] != NULL;
+         next = (next + 1) & mask) {
+        size_t home = slot_of(jobs, jobs->slots[next]->pid);
 
-            return head;
+        // Move the entry unless its home lies cyclically in (gap, next].
+        if (((next - home) & mask) >= ((next - gap) & mask)) {
+            jobs->slots[gap] = jobs->slots[next];
+            gap = next;
         }
+    }
+    jobs->slots[gap] = NULL;
+    jobs->count--;
+
+    proc->next_free = jobs->free_list;
+    jobs->free_list = proc;
+}
+
+/**
+ * Gives job a time limit of limit seconds from now, after which its process
+ * group is sent SIGTERM, and then SIGKILL after grace more seconds unless
+ * grace is 0.
+ */
+void set_deadline(JobTable jobs, Process job, double limit, double grace) {
+    job->deadline = monotonic_time() + limit;
+    job->grace = grace;
 
-        ptr = ptr->next;
+    if (jobs->next_deadline == 0 || job->deadline < jobs->next_deadline) {
+        arm_timer(jobs, job->deadline);
     }
+}
 
-    return head;
+/**
+ * Sets the seconds kill_all() gives jobs to exit after SIGTERM before it
+ * sends SIGKILL.
+ */
+void set_exit_grace(JobTable jobs, double grace) {
+    jobs->exit_grace = grace;
 }
 
 /**
- * Helper function used to terminate a running process. It first attempts a
- * SIGTERM kill command. If unsuccessful, it uses the SIGKILL signal.
+ * Sets the most background jobs that may run at once, 0 for no limit, and
+ * starts queued commands if the limit was raised.
  */
-void term_proc(pid_t pid) {
-    int kill_result;
+void set_job_limit(JobTable jobs, int limit) {
+    jobs->limit = limit;
+    start_queued_jobs(jobs);
+}
 
-    kill_result = kill(pid, SIGTERM);
+/**
+ * Returns the home slot of pid, using Fibonacci hashing to spread the runs
+ * of consecutive pids that are common.
+ */
+size_t slot_of(JobTable jobs, pid_t pid) {
+    int bits = __builtin_ctzl(jobs->capacity);
 
-    if (kill_result == -1) {
-        kill_result = kill(pid, SIGKILL);
+    return ((uint32_t)pid * 2654435769u) >> (32 - bits);
+}
+
+/**
+ * Starts queued commands, oldest first, while the concurrency limit allows.
+ */
+void start_queued_jobs(JobTable jobs) {
+    while (jobs->queue_head != NULL && job_slot_free(jobs)) {
+        struct queued_job *queued = jobs->queue_head;
 
-        if (kill_result != 0) {
-            perror("kill()");
+        jobs->queue_head = queued->next;
+        if (jobs->queue_head == NULL) {
+            jobs->queue_tail = NULL;
         }
+        jobs->queued--;
+
+        start_background(queued->cmd, jobs, queued->notify,
+                         queued->notify_data, queued->out_fd);
+
+        free(queued->cmd);
+        free(queued);
     }
 }
+
+/**
+ * Reaps the children that have exited, removing them from the table without
+ * reporting them.
+ */
+void reap_all(JobTable jobs) {
+    pid_t pid;
+
+    while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+        if (find_proc(jobs, pid) != NULL) {
+            rm_proc(jobs, pid);
+        }
+    }
+}
+
+/**
+ * Blocks until a child process may have terminated, consuming the SIGCHLD
+ * that announced it. Other signals arriving meanwhile are kept for the event
+ * loop. The caller reaps with WNOHANG afterward.
+ */
+void wait_for_child(void) {
+    wait_signal(SIGCHLD, NULL);
+}
+
+/**
+ * Waits until every background job, including those queued, has finished,
+ * reporting each as it does, or until Ctrl-c, which is kept for the shell.
+ *
+ * Returns whether the wait was ended by Ctrl-c.
+ */
+bool wait_all(JobTable jobs) {
+    while (jobs->running > 0 || jobs->queued > 0) {
+        // Background jobs have process groups of their own, so SIGINT
+        // reaches only the shell.
+        if (wait_signals(SIGCHLD, SIGINT, NULL) == SIGINT) {
+            keep_signal(SIGINT);
+            return true;
+        }
+        check_bg_processes(jobs, false);
+    }
+
+    return false;
+}
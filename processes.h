@@ -1,17 +1,113 @@
 #ifndef PROCESSES_H
 #define PROCESSES_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/resource.h>
 #include <sys/types.h>
+#include <time.h>
+
+// Bytes of a job's command line kept for display, including the terminator.
+#define JOB_CMD_LENGTH 128
+
+// Number of job entries allocated at a time for the table's pool.
+#define JOB_SLAB_SIZE 256
+
+// Initial number of slots in the job table, a power of two.
+#define JOB_TABLE_SLOTS 64
+
+// Seconds jobs are given to exit after SIGTERM when smallsh exits, unless
+// jobs -k says otherwise.
+#define EXIT_GRACE 2
+
+enum job_state { JOB_RUNNING, JOB_DONE };
 
-// Stub for process struct, which is implemented in processes.c.
 struct process;
 
+// Called in place of reporting a job on the console when it finishes, with
+// the job's entry, or NULL if it could not be started.
+typedef void (*JobNotify)(struct process *job, void *data);
+
+/**
+ * A job running in the background of smallsh.
+ *
+ * Fields:
+ * pid : the process reported on when the job ends, its last pipeline stage
+ * pgid : the process group holding every stage of the job
+ * job_id : sequence number of the job, starting from 1
+ * state : whether the job is running or has been reaped
+ * start : when the job started, from CLOCK_MONOTONIC
+ * cmdline : the command line, truncated to JOB_CMD_LENGTH - 1 bytes
+ * job : the job this entry belongs to, which is the entry itself except for
+ *      the earlier stages of a pipeline
+ * stages_left : number of the job's processes not yet reaped
+ * wstatus : the wait status of the last stage, once it has been reaped
+ * usage : resources used by the job's reaped processes
+ * deadline : CLOCK_MONOTONIC seconds at which the job is next signalled for
+ *      running too long, or 0 for none
+ * grace : seconds between SIGTERM and SIGKILL, or 0 to send only SIGTERM
+ * timed_out : whether the job has been sent SIGTERM for its time limit
+ * capture : where the job's output is kept, or NULL if it is not captured
+ * notify, notify_data : what the job reports to when it finishes instead of
+ *      the console, for a job started for a client of the server, else NULL
+ * next_free : the next unused entry while the entry is in the free list
+ */
+struct process {
+    pid_t pid;
+    pid_t pgid;
+    int job_id;
+    enum job_state state;
+    struct timespec start;
+    char cmdline[JOB_CMD_LENGTH];
+    struct process *job;
+    int stages_left;
+    int wstatus;
+    struct rusage usage;
+    double deadline;
+    double grace;
+    bool timed_out;
+    struct capture *capture;
+    JobNotify notify;
+    void *notify_data;
+    struct process *next_free;
+};
+
 typedef struct process *Process;
 
-Process add_proc(Process head, pid_t pid);
-Process check_bg_processes(Process head);
-Process find_proc(Process head, pid_t pid);
-void kill_all(Process head);
-Process rm_proc(Process head, pid_t pid);
+// Stub for job table struct, which is implemented in processes.c.
+struct job_table;
+
+typedef struct job_table *JobTable;
+
+// Parsed command, implemented in commands.c.
+struct command_entry;
+
+// Captured output, implemented in capture.c.
+struct capture;
+
+Process add_proc(JobTable jobs, pid_t pid, pid_t pgid, char *cmdline);
+Process add_stage(JobTable jobs, pid_t pid, Process job);
+int check_bg_processes(JobTable jobs, bool at_prompt);
+double exit_grace(JobTable jobs);
+void expire_jobs(JobTable jobs);
+Process find_proc(JobTable jobs, pid_t pid);
+bool has_deadlines(JobTable jobs);
+Process iter_procs(JobTable jobs, size_t *pos);
+bool job_slot_free(JobTable jobs);
+void kill_all(JobTable jobs);
+double monotonic_time(void);
+JobTable new_job_table(void);
+void print_jobs(JobTable jobs);
+int queue_job(JobTable jobs, struct command_entry *cmd, JobNotify notify,
+              void *data, int out_fd);
+void rm_proc(JobTable jobs, pid_t pid);
+void set_deadline(JobTable jobs, Process job, double limit, double grace);
+void set_exit_grace(JobTable jobs, double grace);
+int job_limit(JobTable jobs);
+int job_timer_fd(JobTable jobs);
+void set_job_limit(JobTable jobs, int limit);
+void start_queued_jobs(JobTable jobs);
+bool wait_all(JobTable jobs);
+void wait_for_child(void);
 
 #endif
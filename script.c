@@ -0,0 +1,333 @@
+/**
+ * Compiled scripts, so that a script run again unchanged is not parsed again.
+ *
+ * The first time smallsh runs a script file, it parses every line and
+ * writes the commands to the script cache as a compact list of struct
+ * compiled_stage records, whose arguments and redirections are offsets of
+ * strings stored after them. Later runs map that file and rebuild each
+ * command from it as it is reached, with argv pointing into the mapping, so
+ * no line is read or tokenized again. Lines that fail to parse are kept as
+ * their error messages, printed when they are reached.
+ *
+ * A compiled script is named by the SHA-256 of the script's absolute path,
+ * and its header records the script's device, inode, size, and modification
+ * and change times, so that any change to the script compiles it again. It
+ * is written under a temporary name and renamed into place, and every offset
+ * in it is checked against its length when it is mapped, so that a damaged
+ * file is compiled again too.
+ *
+ * What depends on the moment a command runs is still decided then: the & is
+ * recorded as written and foreground-only mode applied as the command is
+ * rebuilt, and memo keys are computed when the command runs.
+ *
+ * The directory is $SMALLSH_SCRIPT_DIR, else $XDG_CACHE_HOME/smallsh/scripts,
+ * else ~/.cache/smallsh/scripts. If it cannot be used, scripts are read
+ * line by line as before.
+ */
+
+#define _GNU_SOURCE
+#include "script.h"
+#include "commands.h"
+#include "input.h"
+#include "memo.h"
+#include "sha256.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Bytes a compiled script is given to start with.
+#define SCRIPT_INITIAL_SIZE 4096
+
+/**
+ * A compiled script being run.
+ *
+ * Fields:
+ * base : the compiled script, mapped from the cache or in memory
+ * size : number of bytes at base
+ * mapped : whether base is mapped rather than allocated
+ * next : number of commands run so far
+ */
+struct script {
+    char *base;
+    size_t size;
+    bool mapped;
+    uint32_t next;
+};
+
+bool compile_script(char *path, struct stat *st, struct script_buffer *buf);
+bool header_matches(struct script_header *header, struct stat *st,
+                    size_t size);
+bool records_valid(Script script);
+void save_script(char *cache_path, struct script_buffer *buf);
+
+/**
+ * Frees script, unmapping it if it was loaded from the cache.
+ */
+void close_script(Script script) {
+    if (script->mapped) {
+        munmap(script->base, script->size);
+    } else {
+        free(script->base);
+    }
+    free(script);
+}
+
+/**
+ * Parses every line of the script at path, whose file is described by st,
+ * into buf. Returns whether the whole script could be read.
+ */
+bool compile_script(char *path, struct stat *st, struct script_buffer *buf) {
+    struct script_header header = {SCRIPT_MAGIC, SCRIPT_VERSION};
+    uint32_t *offsets = NULL, line_number = 0;
+    size_t count = 0, capacity = 0;
+    Arena arena;
+    Input in;
+    char *line, *error;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    in = open_input(fd);
+    arena = new_arena();
+
+    buf->size = 0;
+    buf->capacity = SCRIPT_INITIAL_SIZE;
+    buf->data = malloc(buf->capacity);
+    script_append(buf, &header, sizeof(header), 8);
+
+    while (true) {
+        while ((line = read_line(in)) == NULL && !input_at_eof(in)) {
+            fill_input(in);
+        }
+        if (line == NULL) {
+            break;
+        }
+        line_number++;
+
+        Command cmd = parse_line(arena, line, false, &error);
+        if (cmd != NULL || error != NULL) {
+            if (count == capacity) {
+                capacity = capacity == 0 ? 64 : capacity * 2;
+                offsets = realloc(offsets, capacity * sizeof(uint32_t));
+            }
+            offsets[count++] = compile_command(buf, cmd, error, line_number);
+        }
+        arena_reset(arena);
+    }
+
+    header.commands = count;
+    header.index = script_append(buf, offsets, count * sizeof(uint32_t),
+                                 sizeof(uint32_t));
+    header.length = buf->size;
+    header.dev = st->st_dev;
+    header.ino = st->st_ino;
+    header.size = st->st_size;
+    header.mtime_sec = st->st_mtim.tv_sec;
+    header.mtime_nsec = st->st_mtim.tv_nsec;
+    header.ctime_sec = st->st_ctim.tv_sec;
+    header.ctime_nsec = st->st_ctim.tv_nsec;
+    memcpy(buf->data, &header, sizeof(header));
+
+    free(offsets);
+    free_arena(arena);
+    close_input(in);
+    return true;
+}
+
+/**
+ * Returns whether header begins a compiled script of size bytes for the
+ * script file described by st, as it is now.
+ */
+bool header_matches(struct script_header *header, struct stat *st,
+                    size_t size) {
+    return size >= sizeof(struct script_header) &&
+           memcmp(header->magic, SCRIPT_MAGIC, sizeof(SCRIPT_MAGIC)) == 0 &&
+           header->version == SCRIPT_VERSION && header->length == size &&
+           header->index % sizeof(uint32_t) == 0 &&
+           header->index + (uint64_t)header->commands * sizeof(uint32_t) <=
+               size &&
+           header->dev == (uint64_t)st->st_dev &&
+           header->ino == (uint64_t)st->st_ino &&
+           header->size == (uint64_t)st->st_size &&
+           header->mtime_sec == st->st_mtim.tv_sec &&
+           header->mtime_nsec == st->st_mtim.tv_nsec &&
+           header->ctime_sec == st->st_ctim.tv_sec &&
+           header->ctime_nsec == st->st_ctim.tv_nsec;
+}
+
+/**
+ * Returns the compiled form of the script at path, which is open as fd,
+ * mapping it from the script cache, or compiling it and saving it there if
+ * it is missing or out of date. Returns NULL if the script cannot be
+ * compiled.
+ */
+Script load_script(char *path, int fd) {
+    char dir[PATH_MAX], cache_path[PATH_MAX], full_path[PATH_MAX];
+    char hex[SHA256_SIZE * 2 + 1];
+    unsigned char key[SHA256_SIZE];
+    struct script_buffer buf;
+    struct sha256 ctx;
+    struct stat st, cached;
+    Script script;
+    int cache_fd;
+
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+        find_cache_dir(dir, sizeof(dir), SCRIPT_DIR_ENV, "scripts") == NULL ||
+        realpath(path, full_path) == NULL) {
+        return NULL;
+    }
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, full_path, strlen(full_path));
+    sha256_final(&ctx, key);
+    sha256_hex(key, hex);
+    snprintf(cache_path, sizeof(cache_path), "%s/%s", dir, hex);
+
+    script = calloc(1, sizeof(struct script));
+
+    cache_fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    if (cache_fd != -1) {
+        if (fstat(cache_fd, &cached) == 0 &&
+            cached.st_size >= (off_t)sizeof(struct script_header)) {
+            script->size = cached.st_size;
+            script->base = mmap(NULL, script->size, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE, cache_fd, 0);
+        }
+        close(cache_fd);
+
+        if (script->base != NULL && script->base != MAP_FAILED &&
+            header_matches((struct script_header *)script->base, &st,
+                           script->size) &&
+            records_valid(script)) {
+            script->mapped = true;
+            return script;
+        }
+        if (script->base != NULL && script->base != MAP_FAILED) {
+            munmap(script->base, script->size);
+        }
+    }
+
+    if (!compile_script(path, &st, &buf)) {
+        free(buf.data);
+        free(script);
+        return NULL;
+    }
+    save_script(cache_path, &buf);
+
+    script->base = buf.data;
+    script->size = buf.size;
+    script->mapped = false;
+    return script;
+}
+
+/**
+ * Returns the next command of script, rebuilt in arena, or NULL once every
+ * command has been returned. The errors of lines that failed to parse are
+ * printed as they are passed.
+ */
+struct command_entry *next_command(Script script, Arena arena, int fg_only) {
+    struct script_header *header = (struct script_header *)script->base;
+    uint32_t *index = (uint32_t *)(script->base + header->index);
+
+    while (script->next < header->commands) {
+        char *error;
+        Command cmd;
+
+        TRACE(TRACE_PARSE_START, 0, 0);
+        cmd = load_command(arena, script->base, index[script->next++],
+                           fg_only, &error);
+        TRACE(TRACE_PARSE_END, 0, cmd != NULL);
+
+        if (cmd != NULL) {
+            return cmd;
+        }
+        parse_error(error);
+    }
+
+    return NULL;
+}
+
+/**
+ * Returns whether every command of the mapped script can be loaded without
+ * reading outside it, which a truncated or damaged cache file could
+ * otherwise make load_command() do. header_matches() has checked the index.
+ */
+bool records_valid(Script script) {
+    struct script_header *header = (struct script_header *)script->base;
+    uint32_t *index = (uint32_t *)(script->base + header->index);
+
+    for (uint32_t i = 0; i < header->commands; i++) {
+        if (index[i] == 0 ||
+            !check_command(script->base, script->size, index[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Writes the compiled script in buf to cache_path, through a temporary file
+ * so that no other smallsh reads it half written. A failure only means the
+ * script is compiled again next time.
+ */
+void save_script(char *cache_path, struct script_buffer *buf) {
+    char tmp_path[PATH_MAX];
+    size_t done = 0;
+    int fd;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", cache_path, (int)getpid());
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        return;
+    }
+
+    while (done < buf->size) {
+        ssize_t written = write(fd, buf->data + done, buf->size - done);
+        if (written <= 0) {
+            break;
+        }
+        done += written;
+    }
+    close(fd);
+
+    if (done < buf->size || rename(tmp_path, cache_path) == -1) {
+        unlink(tmp_path);
+    }
+}
+
+/**
+ * Appends size bytes of data to buf, first padding it to a multiple of
+ * align bytes. Returns the offset of the copy.
+ */
+uint32_t script_append(struct script_buffer *buf, const void *data,
+                       size_t size, size_t align) {
+    size_t offset = (buf->size + align - 1) / align * align;
+
+    while (offset + size > buf->capacity) {
+        buf->capacity *= 2;
+        buf->data = realloc(buf->data, buf->capacity);
+    }
+
+    memset(buf->data + buf->size, 0, offset - buf->size);
+    memcpy(buf->data + offset, data, size);
+    buf->size = offset + size;
+
+    return offset;
+}
+
+/**
+ * Appends str and its terminator to buf. Returns the offset of the copy.
+ */
+uint32_t script_string(struct script_buffer *buf, char *str) {
+    return script_append(buf, str, strlen(str) + 1, 1);
+}
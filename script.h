@@ -0,0 +1,110 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include "arena.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Environment variable naming the directory of compiled scripts.
+#define SCRIPT_DIR_ENV "SMALLSH_SCRIPT_DIR"
+
+// Identifies compiled scripts; the version changes with the layout.
+#define SCRIPT_MAGIC "smshscr"
+#define SCRIPT_VERSION 3
+
+/**
+ * Start of a compiled script.
+ *
+ * Fields:
+ * dev, ino, size, mtime_*, ctime_* : the script file it was compiled from,
+ *      which must be unchanged for it to be used
+ * commands : number of commands
+ * index : offset of an array of the offsets of each command's first stage
+ * length : size of the compiled script in bytes
+ */
+struct script_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t commands;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+    uint32_t index;
+    uint32_t length;
+};
+
+/**
+ * One stage of a compiled command. Offsets are from the start of the
+ * compiled script, with 0 for none, and strings are null-terminated.
+ *
+ * Fields:
+ * time_limit, kill_grace, is_bg, is_timed, is_memo, list_op,
+ *      has_patterns : as in a parsed command, with is_bg recording the &
+ *      whether or not foreground-only mode is on
+ * argc : number of arguments
+ * argv : offset of argc offsets of the arguments
+ * in_file, out_file : offsets of the redirected files
+ * memo_vars : offset of the offsets of the names given to memo -e, ending
+ *      with 0
+ * error : offset of the message of a line that failed to parse, in which
+ *      case the stage holds nothing else
+ * line : line of the script the command is on
+ * next : offset of the next stage of the pipeline
+ * next_list : offset of the first stage of the next pipeline of the command
+ *      list, set on first stages only
+ */
+struct compiled_stage {
+    double time_limit;
+    double kill_grace;
+    uint32_t argc;
+    uint32_t argv;
+    uint32_t in_file;
+    uint32_t out_file;
+    uint32_t memo_vars;
+    uint32_t error;
+    uint32_t line;
+    uint32_t next;
+    uint32_t next_list;
+    uint8_t is_bg;
+    uint8_t is_timed;
+    uint8_t is_memo;
+    uint8_t list_op;
+    uint8_t has_patterns;
+    uint8_t padding[3];
+};
+
+/**
+ * A compiled script being built in memory.
+ *
+ * Fields:
+ * data : the bytes written so far
+ * size : number of bytes written
+ * capacity : number of bytes data has room for
+ */
+struct script_buffer {
+    char *data;
+    size_t size;
+    size_t capacity;
+};
+
+// Incomplete type to encapsulate its data structure.
+// The struct is implemented in script.c.
+struct script;
+
+typedef struct script *Script;
+
+// Parsed command, implemented in commands.c.
+struct command_entry;
+
+void close_script(Script script);
+Script load_script(char *path, int fd);
+struct command_entry *next_command(Script script, Arena arena, int fg_only);
+uint32_t script_append(struct script_buffer *buf, const void *data,
+                       size_t size, size_t align);
+uint32_t script_string(struct script_buffer *buf, char *str);
+
+#endif
@@ -0,0 +1,501 @@
+/**
+ * Server mode, in which smallsh --serve path runs the command lines that
+ * local clients send it over a UNIX domain socket at path, so that a program
+ * running many commands need not start a shell for each one.
+ *
+ * A client sends command lines, each ending with a newline. They are parsed
+ * like lines of a script, with & ignored, and run one after another per
+ * connection as background jobs of the server. The commands of different
+ * clients thus run at once, under the same concurrency limit, queue and time
+ * limits as any background job. For each line the server replies with one
+ * line: the command's status as the status built-in prints it, "Error: "
+ * and the reason if it could not be parsed or run, or an empty line for a
+ * blank line or a comment.
+ *
+ * A client may pass a descriptor with what it sends, as SCM_RIGHTS ancillary
+ * data. The output and stderr of its commands from then on go to that
+ * descriptor, so that they stream straight to the client rather than through
+ * the server. Otherwise their output is discarded, as for any background job.
+ *
+ * Connections are watched by an epoll instance of the server's own, which
+ * the shell's event loop watches in turn, so hundreds of clients take one of
+ * the loop's descriptors. A connection is not read while its command runs.
+ * A client that goes away leaves its command running, and a client that
+ * does not read its replies is disconnected rather than holding up the
+ * server.
+ *
+ * The server runs until it receives SIGINT or SIGTERM, then removes the
+ * socket and shuts down its jobs as smallsh does on exit.
+ */
+
+#define _GNU_SOURCE
+#include "server.h"
+#include "arena.h"
+#include "builtins.h"
+#include "commands.h"
+#include "events.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * A client connected to the server.
+ *
+ * Fields:
+ * fd : the connected socket
+ * out_fd : the descriptor the client passed for output, or -1
+ * job_fd : the copy of out_fd given to the running command, or -1
+ * busy : whether a command is running or queued for the client
+ * starting : whether its command is being started, so that a command that
+ *      fails at once is not followed by the next from within its own start
+ * at_eof : whether the client has sent everything it will send
+ * failed : whether a reply could not be sent, so the client is treated as
+ *      gone
+ * closed : whether the socket is closed, in which case the connection is
+ *      freed when its command finishes
+ * watched : the events the server's epoll instance waits for on fd
+ * length : number of bytes of buf received and not yet run
+ * buf : the lines received
+ */
+struct connection {
+    int fd;
+    int out_fd;
+    int job_fd;
+    bool busy;
+    bool starting;
+    bool at_eof;
+    bool failed;
+    bool closed;
+    uint32_t watched;
+    size_t length;
+    char buf[SERVER_LINE_MAX];
+};
+
+// The listening socket and the epoll instance watching it and every
+// connection. The socket's events carry a NULL pointer, the connections'
+// their struct connection.
+int listen_fd = -1;
+int server_epoll = -1;
+
+// The jobs of the shell, in which clients' commands run, and the arena they
+// are parsed in.
+JobTable server_jobs;
+Arena server_arena;
+
+void accept_clients(void);
+void close_connection(struct connection *conn);
+bool is_stale(struct sockaddr_un *addr);
+void job_done(Process job, void *data);
+int open_socket(char *path);
+void read_requests(struct connection *conn);
+void reply(struct connection *conn, char *text);
+void run_request(struct connection *conn, char *line);
+void run_requests(struct connection *conn);
+void server_ready(int fd, void *data);
+void watch_connection(struct connection *conn);
+
+/**
+ * Accepts every client waiting to connect.
+ */
+void accept_clients(void) {
+    struct epoll_event event = {EPOLLIN};
+    struct connection *conn;
+    int fd;
+
+    while ((fd = accept4(listen_fd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1 ||
+           errno == EINTR || errno == ECONNABORTED) {
+        if (fd == -1) {
+            continue;
+        }
+
+        conn = malloc(sizeof(struct connection));
+        conn->fd = fd;
+        conn->out_fd = -1;
+        conn->job_fd = -1;
+        conn->busy = false;
+        conn->starting = false;
+        conn->at_eof = false;
+        conn->failed = false;
+        conn->closed = false;
+        conn->watched = EPOLLIN;
+        conn->length = 0;
+
+        event.data.ptr = conn;
+        if (epoll_ctl(server_epoll, EPOLL_CTL_ADD, fd, &event) == -1) {
+            perror("smallsh: --serve: epoll_ctl()");
+            close(fd);
+            free(conn);
+        }
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("smallsh: --serve: accept()");
+    }
+}
+
+/**
+ * Closes conn's socket, freeing conn unless its command is still to finish.
+ */
+void close_connection(struct connection *conn) {
+    epoll_ctl(server_epoll, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    if (conn->out_fd != -1) {
+        close(conn->out_fd);
+    }
+    conn->closed = true;
+
+    if (!conn->busy) {
+        free(conn);
+    }
+}
+
+/**
+ * Replies to the client whose command has finished, or could not be started
+ * if job is NULL, with its status, then runs the client's next line.
+ */
+void job_done(Process job, void *data) {
+    struct connection *conn = data;
+    char status[STATUS_LENGTH];
+
+    // A command that cannot be started has the status it would have in the
+    // foreground.
+    if (job == NULL) {
+        update_status(W_EXITCODE(EXIT_FAILURE, 0));
+    }
+    format_status(status, sizeof(status));
+
+    if (conn->job_fd != -1) {
+        close(conn->job_fd);
+        conn->job_fd = -1;
+    }
+    conn->busy = false;
+
+    if (conn->closed) {
+        free(conn);
+        return;
+    }
+
+    reply(conn, status);
+    if (!conn->starting) {
+        run_requests(conn);
+    }
+}
+
+/**
+ * Returns whether addr names a socket that nothing is listening on, left by
+ * a server that is no longer running.
+ */
+bool is_stale(struct sockaddr_un *addr) {
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool stale;
+
+    if (probe == -1) {
+        return false;
+    }
+    stale = connect(probe, (struct sockaddr *)addr, sizeof(*addr)) == -1 &&
+            errno == ECONNREFUSED;
+    close(probe);
+
+    return stale;
+}
+
+/**
+ * Creates the socket at path and listens on it. A stale socket at path is
+ * replaced.
+ *
+ * Returns the socket, or -1 if it cannot be created, which is reported.
+ */
+int open_socket(char *path) {
+    struct sockaddr_un addr = {AF_UNIX};
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "smallsh: %s: socket path too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("smallsh: socket()");
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        if (errno != EADDRINUSE || !is_stale(&addr) || unlink(path) == -1 ||
+            bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+            fprintf(stderr, "smallsh: %s: %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, SERVER_BACKLOG) == -1) {
+        fprintf(stderr, "smallsh: %s: %s\n", path, strerror(errno));
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Reads what conn's client has sent, keeping the last descriptor it passed,
+ * then runs the lines received.
+ */
+void read_requests(struct connection *conn) {
+    char control[CMSG_SPACE(sizeof(int) * 4)];
+    struct iovec iov;
+    struct msghdr msg = {0};
+    struct cmsghdr *cmsg;
+    ssize_t got;
+
+    while (conn->length < SERVER_LINE_MAX && !conn->at_eof) {
+        iov.iov_base = conn->buf + conn->length;
+        iov.iov_len = SERVER_LINE_MAX - conn->length;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        got = recvmsg(conn->fd, &msg, MSG_CMSG_CLOEXEC);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (got <= 0) {
+            conn->at_eof = true;
+            break;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET ||
+                cmsg->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+
+            int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int *fds = (int *)CMSG_DATA(cmsg);
+
+            // The first descriptor is the output; any others are not used.
+            for (int i = 0; i < count; i++) {
+                if (i > 0) {
+                    close(fds[i]);
+                    continue;
+                }
+                if (conn->out_fd != -1) {
+                    close(conn->out_fd);
+                }
+                conn->out_fd = fds[i];
+            }
+        }
+
+        conn->length += got;
+    }
+
+    run_requests(conn);
+}
+
+/**
+ * Sends text as a line to conn's client. A client that cannot take it is
+ * treated as gone.
+ */
+void reply(struct connection *conn, char *text) {
+    char line[SERVER_LINE_MAX];
+    int length = snprintf(line, sizeof(line), "%s\n", text);
+
+    if (send(conn->fd, line, length, MSG_NOSIGNAL | MSG_DONTWAIT) != length) {
+        conn->at_eof = true;
+        conn->failed = true;
+    }
+}
+
+/**
+ * Parses line, received from conn's client, and starts it as a job that
+ * replies once it has finished, or replies at once if it cannot be run.
+ */
+void run_request(struct connection *conn, char *line) {
+    char text[SERVER_LINE_MAX];
+    char *error;
+    Command cmd;
+
+    cmd = parse_line(server_arena, line, true, &error);
+    if (cmd == NULL) {
+        text[0] = '\0';
+        if (error != NULL) {
+            snprintf(text, sizeof(text), "Error: %s", error);
+        }
+        reply(conn, text);
+        arena_reset(server_arena);
+        return;
+    }
+
+    // The command gets a descriptor of its own, as the client may pass
+    // another before it finishes.
+    conn->job_fd = conn->out_fd != -1
+                       ? fcntl(conn->out_fd, F_DUPFD_CLOEXEC, 0)
+                       : -1;
+    conn->busy = true;
+    conn->starting = true;
+    expand_wildcards(server_arena, cmd);
+    error = client_command(cmd, server_jobs, job_done, conn, conn->job_fd);
+    conn->starting = false;
+    arena_reset(server_arena);
+
+    if (error != NULL) {
+        if (conn->job_fd != -1) {
+            close(conn->job_fd);
+            conn->job_fd = -1;
+        }
+        conn->busy = false;
+        snprintf(text, sizeof(text), "Error: %s", error);
+        reply(conn, text);
+    }
+}
+
+/**
+ * Runs the lines received from conn's client in turn, until one is running
+ * or none is left, then closes the connection if the client is done with it.
+ */
+void run_requests(struct connection *conn) {
+    while (!conn->busy) {
+        char *newline = memchr(conn->buf, '\n', conn->length);
+        size_t used;
+
+        if (newline == NULL) {
+            if (conn->length == SERVER_LINE_MAX) {
+                reply(conn, "Error: command line too long");
+                conn->at_eof = true;
+                conn->length = 0;
+            }
+            if (!conn->at_eof) {
+                break;
+            }
+            if (conn->length == 0) {
+                close_connection(conn);
+                return;
+            }
+            // A last line may lack its newline.
+            newline = conn->buf + conn->length;
+            conn->length++;
+        }
+
+        *newline = '\0';
+        used = newline - conn->buf + 1;
+        run_request(conn, conn->buf);
+
+        memmove(conn->buf, conn->buf + used, conn->length - used);
+        conn->length -= used;
+
+        // Lines whose replies could not be sent are not run.
+        if (conn->failed) {
+            conn->length = 0;
+        }
+    }
+
+    watch_connection(conn);
+}
+
+/**
+ * Runs the server at path, with clients' commands run as jobs of jobs, until
+ * SIGINT or SIGTERM is received.
+ *
+ * Returns EXIT_SUCCESS, or EXIT_FAILURE if the server could not be started.
+ */
+int serve(char *path, JobTable jobs) {
+    struct epoll_event event = {EPOLLIN};
+
+    listen_fd = open_socket(path);
+    if (listen_fd == -1) {
+        return EXIT_FAILURE;
+    }
+
+    server_epoll = epoll_create1(EPOLL_CLOEXEC);
+    event.data.ptr = NULL;
+    if (server_epoll == -1 ||
+        epoll_ctl(server_epoll, EPOLL_CTL_ADD, listen_fd, &event) == -1 ||
+        add_event(server_epoll, server_ready, NULL) == -1 ||
+        watch_signal(SIGTERM) == -1) {
+        perror("smallsh: --serve");
+        close(listen_fd);
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+
+    server_jobs = jobs;
+    server_arena = new_arena();
+
+    while (true) {
+        run_events(-1);
+
+        if (take_signal(SIGCHLD)) {
+            check_bg_processes(jobs, false);
+        }
+        take_signal(SIGTSTP);
+        if (take_signal(SIGINT) || take_signal(SIGTERM)) {
+            break;
+        }
+    }
+
+    remove_event(server_epoll);
+    close(server_epoll);
+    close(listen_fd);
+    unlink(path);
+    free_arena(server_arena);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Handles the connections and new clients that the server's epoll instance
+ * reports ready.
+ */
+void server_ready(int fd, void *data) {
+    struct epoll_event events[SERVER_EVENTS];
+    int ready;
+
+    ready = epoll_wait(fd, events, SERVER_EVENTS, 0);
+    for (int i = 0; i < ready; i++) {
+        struct connection *conn = events[i].data.ptr;
+
+        if (conn == NULL) {
+            accept_clients();
+        } else if (events[i].events & EPOLLIN) {
+            read_requests(conn);
+        } else {
+            // Hung up while its command runs.
+            close_connection(conn);
+        }
+    }
+}
+
+/**
+ * Has the server's epoll instance wait for conn's client to send more only
+ * while there is nothing of its to run.
+ */
+void watch_connection(struct connection *conn) {
+    uint32_t wanted = conn->busy || conn->at_eof ? 0 : EPOLLIN;
+    struct epoll_event event = {wanted};
+
+    if (conn->closed || wanted == conn->watched) {
+        return;
+    }
+
+    event.data.ptr = conn;
+    epoll_ctl(server_epoll, EPOLL_CTL_MOD, conn->fd, &event);
+    conn->watched = wanted;
+}
@@ -0,0 +1,17 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "processes.h"
+
+// Longest command line a client may send, including its newline.
+#define SERVER_LINE_MAX 4096
+
+// Connections waiting to be accepted before more are refused.
+#define SERVER_BACKLOG 512
+
+// Events the server handles per call to epoll_wait().
+#define SERVER_EVENTS 64
+
+int serve(char *path, JobTable jobs);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes in a SHA-256 digest.
+#define SHA256_SIZE 32
+
+/**
+ * The state of a SHA-256 computation.
+ *
+ * Fields:
+ * state : the hash of the blocks processed so far
+ * length : bytes given so far
+ * block : bytes not yet processed, fewer than a block's 64
+ */
+struct sha256 {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char block[64];
+};
+
+void sha256_final(struct sha256 *ctx, unsigned char digest[SHA256_SIZE]);
+void sha256_hex(unsigned char digest[SHA256_SIZE], char *hex);
+void sha256_init(struct sha256 *ctx);
+void sha256_update(struct sha256 *ctx, const void *data, size_t size);
+
+#endif
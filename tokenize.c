@@ -0,0 +1,338 @@
+/**
+ * Tokenizer for smallsh command lines.
+ *
+ * A line is first classified a block at a time into bitmaps marking the
+ * bytes that separate tokens, the operator bytes and the wildcard bytes,
+ * using AVX2 or SSE2 where the CPU supports it and a byte loop otherwise.
+ * Tokens are then found by counting zero bits, so the per-byte work is a few
+ * vector compares, and a word is known to be a pattern to expand without
+ * looking at its bytes again.
+ */
+
+#include "tokenize.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+typedef void (*scan_func)(const char *line, size_t len, uint64_t *spaces,
+                          uint64_t *operators, uint64_t *wildcards);
+
+void scan_scalar(const char *line, size_t len, uint64_t *spaces,
+                 uint64_t *operators, uint64_t *wildcards);
+#ifdef HAVE_X86_SIMD
+void scan_sse2(const char *line, size_t len, uint64_t *spaces,
+               uint64_t *operators, uint64_t *wildcards);
+void scan_avx2(const char *line, size_t len, uint64_t *spaces,
+               uint64_t *operators, uint64_t *wildcards);
+#endif
+
+/**
+ * The classifiers available, fastest first.
+ */
+struct scanner {
+    const char *name;
+    scan_func scan;
+    bool (*supported)(void);
+};
+
+bool always_supported(void);
+#ifdef HAVE_X86_SIMD
+bool avx2_supported(void);
+bool sse2_supported(void);
+#endif
+
+struct scanner scanners[] = {
+#ifdef HAVE_X86_SIMD
+    {"avx2", scan_avx2, avx2_supported},
+    {"sse2", scan_sse2, sse2_supported},
+#endif
+    {"scalar", scan_scalar, always_supported},
+};
+
+// The classifier in use, chosen on first use if not selected.
+struct scanner *current_scanner = NULL;
+
+bool always_supported(void) {
+    return true;
+}
+
+#ifdef HAVE_X86_SIMD
+bool avx2_supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+bool sse2_supported(void) {
+    return __builtin_cpu_supports("sse2");
+}
+#endif
+
+/**
+ * Classifies the bytes of line from index start onward one at a time, as the
+ * vector scanners do: spaces, tabs and newlines separate tokens, <, >, |, &
+ * and ; are operator bytes, and those of TOKEN_WILDCARDS are wildcards.
+ */
+void scan_tail(const char *line, size_t start, size_t len, uint64_t *spaces,
+               uint64_t *operators, uint64_t *wildcards) {
+    for (size_t i = start; i < len; i++) {
+        uint64_t bit = (uint64_t)1 << (i % 64);
+        char c = line[i];
+
+        if (c == ' ' || c == '\t' || c == '\n') {
+            spaces[i / 64] |= bit;
+        } else if (c == '<' || c == '>' || c == '|' || c == '&' ||
+                   c == ';') {
+            operators[i / 64] |= bit;
+        } else if (c == '*' || c == '?' || c == '[') {
+            wildcards[i / 64] |= bit;
+        }
+    }
+}
+
+void scan_scalar(const char *line, size_t len, uint64_t *spaces,
+                 uint64_t *operators, uint64_t *wildcards) {
+    scan_tail(line, 0, len, spaces, operators, wildcards);
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * Classifies line 16 bytes at a time with SSE2 compares.
+ */
+__attribute__((target("sse2"))) void
+scan_sse2(const char *line, size_t len, uint64_t *spaces,
+          uint64_t *operators, uint64_t *wildcards) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i less = _mm_set1_epi8('<');
+    const __m128i greater = _mm_set1_epi8('>');
+    const __m128i bar = _mm_set1_epi8('|');
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i semi = _mm_set1_epi8(';');
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i question = _mm_set1_epi8('?');
+    const __m128i bracket = _mm_set1_epi8('[');
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(line + i));
+        __m128i is_space = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, space),
+                         _mm_cmpeq_epi8(bytes, tab)),
+            _mm_cmpeq_epi8(bytes, newline));
+        __m128i is_op = _mm_or_si128(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, less),
+                                      _mm_cmpeq_epi8(bytes, greater)),
+                         _mm_or_si128(_mm_cmpeq_epi8(bytes, bar),
+                                      _mm_cmpeq_epi8(bytes, amp))),
+            _mm_cmpeq_epi8(bytes, semi));
+        __m128i is_wild = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, star),
+                         _mm_cmpeq_epi8(bytes, question)),
+            _mm_cmpeq_epi8(bytes, bracket));
+
+        // Blocks of 16 never straddle a 64-bit word.
+        spaces[i / 64] |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_space)
+                          << (i % 64);
+        operators[i / 64] |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_op)
+                             << (i % 64);
+        wildcards[i / 64] |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_wild)
+                             << (i % 64);
+    }
+
+    scan_tail(line, i, len, spaces, operators, wildcards);
+}
+
+/**
+ * Classifies line 32 bytes at a time with AVX2 compares.
+ */
+__attribute__((target("avx2"))) void
+scan_avx2(const char *line, size_t len, uint64_t *spaces,
+          uint64_t *operators, uint64_t *wildcards) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i less = _mm256_set1_epi8('<');
+    const __m256i greater = _mm256_set1_epi8('>');
+    const __m256i bar = _mm256_set1_epi8('|');
+    const __m256i amp = _mm256_set1_epi8('&');
+    const __m256i semi = _mm256_set1_epi8(';');
+    const __m256i star = _mm256_set1_epi8('*');
+    const __m256i question = _mm256_set1_epi8('?');
+    const __m256i bracket = _mm256_set1_epi8('[');
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)(line + i));
+        __m256i is_space = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(bytes, space),
+                            _mm256_cmpeq_epi8(bytes, tab)),
+            _mm256_cmpeq_epi8(bytes, newline));
+        __m256i is_op = _mm256_or_si256(
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, less),
+                                            _mm256_cmpeq_epi8(bytes, greater)),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(bytes, bar),
+                                            _mm256_cmpeq_epi8(bytes, amp))),
+            _mm256_cmpeq_epi8(bytes, semi));
+        __m256i is_wild = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(bytes, star),
+                            _mm256_cmpeq_epi8(bytes, question)),
+            _mm256_cmpeq_epi8(bytes, bracket));
+
+        // Blocks of 32 never straddle a 64-bit word.
+        spaces[i / 64] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(is_space)
+                          << (i % 64);
+        operators[i / 64] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(is_op)
+                             << (i % 64);
+        wildcards[i / 64] |=
+            (uint64_t)(uint32_t)_mm256_movemask_epi8(is_wild) << (i % 64);
+    }
+
+    scan_tail(line, i, len, spaces, operators, wildcards);
+}
+#endif
+
+/**
+ * Prepares tok to split line, of len bytes, allocating its bitmaps from
+ * arena.
+ */
+void init_tokenizer(struct tokenizer *tok, Arena arena, char *line,
+                    size_t len) {
+    size_t words = len / 64 + 1;
+
+    if (current_scanner == NULL) {
+        select_scanner(NULL);
+    }
+
+    tok->line = line;
+    tok->len = len;
+    tok->pos = 0;
+    tok->spaces = arena_alloc(arena, words * sizeof(uint64_t));
+    tok->operators = arena_alloc(arena, words * sizeof(uint64_t));
+    tok->wildcards = arena_alloc(arena, words * sizeof(uint64_t));
+    memset(tok->spaces, 0, words * sizeof(uint64_t));
+    memset(tok->operators, 0, words * sizeof(uint64_t));
+    memset(tok->wildcards, 0, words * sizeof(uint64_t));
+
+    current_scanner->scan(line, len, tok->spaces, tok->operators,
+                          tok->wildcards);
+
+    // Mark the bytes past the end as separators, so every token ends.
+    tok->spaces[len / 64] |= ~(uint64_t)0 << (len % 64);
+}
+
+/**
+ * Returns the next token of the line, terminated in place, and sets kind to
+ * its kind. A single operator byte is an operator token, as are && and ||;
+ * operator bytes within any other token are ordinary text. A word holding
+ * *, ? or [ is a pattern.
+ *
+ * Returns NULL when there are no more tokens.
+ */
+char *next_token(struct tokenizer *tok, enum token_kind *kind) {
+    size_t word = tok->pos / 64;
+    uint64_t bits;
+    size_t start, end;
+
+    // Find the first byte at or after pos that is not a separator.
+    bits = ~tok->spaces[word] & (~(uint64_t)0 << (tok->pos % 64));
+    while (bits == 0) {
+        if (++word > tok->len / 64) {
+            tok->pos = tok->len;
+            return NULL;
+        }
+        bits = ~tok->spaces[word];
+    }
+    start = word * 64 + __builtin_ctzll(bits);
+
+    // Then the first separator after it, which always exists.
+    bits = tok->spaces[word] & (~(uint64_t)0 << (start % 64));
+    while (bits == 0) {
+        bits = tok->spaces[++word];
+    }
+    end = word * 64 + __builtin_ctzll(bits);
+
+    tok->line[end] = '\0';
+    tok->pos = end < tok->len ? end + 1 : tok->len;
+
+    *kind = TOKEN_WORD;
+    for (word = start / 64; word <= (end - 1) / 64; word++) {
+        uint64_t wild = tok->wildcards[word];
+
+        // Only the bits from start to end count.
+        if (word == start / 64) {
+            wild &= ~(uint64_t)0 << (start % 64);
+        }
+        if (word == (end - 1) / 64 && end % 64 != 0) {
+            wild &= ~(~(uint64_t)0 << (end % 64));
+        }
+        if (wild != 0) {
+            *kind = TOKEN_PATTERN;
+            break;
+        }
+    }
+
+    if (end - start == 1 &&
+        (tok->operators[start / 64] >> (start % 64)) & 1) {
+        switch (tok->line[start]) {
+            case '<':
+                *kind = TOKEN_IN;
+                break;
+            case '>':
+                *kind = TOKEN_OUT;
+                break;
+            case '|':
+                *kind = TOKEN_PIPE;
+                break;
+            case '&':
+                *kind = TOKEN_BG;
+                break;
+            case ';':
+                *kind = TOKEN_SEQ;
+                break;
+        }
+    } else if (end - start == 2 && tok->line[start] == tok->line[start + 1] &&
+               (tok->operators[start / 64] >> (start % 64)) & 1) {
+        // Doubled, & and | join the commands of a list.
+        if (tok->line[start] == '&') {
+            *kind = TOKEN_AND;
+        } else if (tok->line[start] == '|') {
+            *kind = TOKEN_OR;
+        }
+    }
+
+    return tok->line + start;
+}
+
+/**
+ * Returns the name of the classifier in use.
+ */
+const char *scanner_name(void) {
+    if (current_scanner == NULL) {
+        select_scanner(NULL);
+    }
+
+    return current_scanner->name;
+}
+
+/**
+ * Chooses the classifier called name ("avx2", "sse2" or "scalar"), or the
+ * fastest the CPU supports if name is NULL.
+ *
+ * Returns 0 if successful, 1 if name is unknown or unsupported.
+ */
+int select_scanner(const char *name) {
+    for (size_t i = 0; i < sizeof(scanners) / sizeof(scanners[0]); i++) {
+        if ((name == NULL || strcmp(name, scanners[i].name) == 0) &&
+            scanners[i].supported()) {
+            current_scanner = &scanners[i];
+            return 0;
+        }
+    }
+
+    return 1;
+}
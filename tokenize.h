@@ -0,0 +1,49 @@
+#ifndef TOKENIZE_H
+#define TOKENIZE_H
+
+#include "arena.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes that make a word a pattern to expand into the names it matches.
+#define TOKEN_WILDCARDS "*?["
+
+enum token_kind {
+    TOKEN_WORD,
+    TOKEN_IN,
+    TOKEN_OUT,
+    TOKEN_PIPE,
+    TOKEN_BG,
+    TOKEN_SEQ,
+    TOKEN_AND,
+    TOKEN_OR,
+    TOKEN_PATTERN
+};
+
+/**
+ * State for splitting a line into tokens.
+ *
+ * Fields:
+ * line : the line, which is split in place
+ * len : number of bytes in line
+ * spaces : bitmap with bit i set if line[i] separates tokens, or i >= len
+ * operators : bitmap with bit i set if line[i] is an operator byte
+ * wildcards : bitmap with bit i set if line[i] is a wildcard byte
+ * pos : index of the first byte not yet returned in a token
+ */
+struct tokenizer {
+    char *line;
+    size_t len;
+    uint64_t *spaces;
+    uint64_t *operators;
+    uint64_t *wildcards;
+    size_t pos;
+};
+
+void init_tokenizer(struct tokenizer *tok, Arena arena, char *line,
+                    size_t len);
+char *next_token(struct tokenizer *tok, enum token_kind *kind);
+const char *scanner_name(void);
+int select_scanner(const char *name);
+
+#endif
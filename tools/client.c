@@ -0,0 +1,179 @@
+/**
+ * Client of smallsh --serve, which sends command lines to the server's
+ * socket and prints the status the server replies with for each.
+ *
+ * Given a command, runs it and exits with its status: its exit value, 128
+ * plus the signal that terminated it, or 1 if it could not be run. Otherwise
+ * runs the lines read from stdin, one at a time.
+ *
+ * Usage: smallsh-client [-o] socket [command [arg ...]]
+ *  -o : pass stdout to the server, so that the output and stderr of the
+ *      commands are written to it
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Longest command line or reply, as for the server.
+#define LINE_MAX_SIZE 4096
+
+int connect_server(char *path);
+int exit_code(char *reply);
+bool read_reply(FILE *replies, char *reply);
+bool send_line(int fd, char *line, bool pass_stdout);
+
+int main(int argc, char *argv[]) {
+    char line[LINE_MAX_SIZE], reply[LINE_MAX_SIZE];
+    bool pass_stdout = false;
+    int arg = 1, fd, code = 0;
+    FILE *replies;
+
+    if (arg < argc && strcmp(argv[arg], "-o") == 0) {
+        pass_stdout = true;
+        arg++;
+    }
+    if (arg >= argc) {
+        fprintf(stderr,
+                "usage: smallsh-client [-o] socket [command [arg ...]]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fd = connect_server(argv[arg++]);
+    replies = fdopen(dup(fd), "r");
+
+    if (arg < argc) {
+        // The arguments make up one command line.
+        size_t len = 0;
+        for (; arg < argc && len < sizeof(line); arg++) {
+            len += snprintf(line + len, sizeof(line) - len,
+                            len == 0 ? "%s" : " %s", argv[arg]);
+        }
+        if (len >= sizeof(line) - 1) {
+            fprintf(stderr, "smallsh-client: command line too long\n");
+            exit(EXIT_FAILURE);
+        }
+        strcat(line, "\n");
+
+        if (!send_line(fd, line, pass_stdout) || !read_reply(replies, reply)) {
+            exit(EXIT_FAILURE);
+        }
+        printf("%s", reply);
+        exit(exit_code(reply));
+    }
+
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        if (strchr(line, '\n') == NULL) {
+            strcat(line, "\n");
+        }
+        if (!send_line(fd, line, pass_stdout) || !read_reply(replies, reply)) {
+            exit(EXIT_FAILURE);
+        }
+        pass_stdout = false;
+
+        if (reply[0] != '\n') {
+            printf("%s", reply);
+            fflush(stdout);
+            code = exit_code(reply);
+        }
+    }
+
+    exit(code);
+}
+
+/**
+ * Connects to the server listening at path, exiting if it cannot.
+ */
+int connect_server(char *path) {
+    struct sockaddr_un addr = {AF_UNIX};
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "smallsh-client: %s: socket path too long\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    return fd;
+}
+
+/**
+ * Returns the exit code matching reply, a status line from the server.
+ */
+int exit_code(char *reply) {
+    int value;
+
+    if (sscanf(reply, "exit value %d", &value) == 1) {
+        return value;
+    }
+    if (sscanf(reply, "terminated by signal %d", &value) == 1) {
+        return 128 + value;
+    }
+    return reply[0] == '\n' ? 0 : 1;
+}
+
+/**
+ * Reads the server's reply to a line into reply. Returns false, reporting
+ * it, if the server has gone.
+ */
+bool read_reply(FILE *replies, char *reply) {
+    if (fgets(reply, LINE_MAX_SIZE, replies) == NULL) {
+        fprintf(stderr, "smallsh-client: server closed the connection\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Sends line to the server, with stdout if pass_stdout. Returns false,
+ * reporting it, if it cannot be sent.
+ */
+bool send_line(int fd, char *line, bool pass_stdout) {
+    char control[CMSG_SPACE(sizeof(int))] = {0};
+    struct iovec iov = {line, strlen(line)};
+    struct msghdr msg = {0};
+    struct cmsghdr *cmsg;
+    ssize_t sent;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (pass_stdout) {
+        int out = STDOUT_FILENO;
+
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &out, sizeof(int));
+    }
+
+    // Output written before the command's must come first.
+    fflush(stdout);
+
+    while (iov.iov_len > 0) {
+        sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent == -1) {
+            perror("smallsh-client: sendmsg()");
+            return false;
+        }
+        iov.iov_base = (char *)iov.iov_base + sent;
+        iov.iov_len -= sent;
+        msg.msg_control = NULL;
+        msg.msg_controllen = 0;
+    }
+
+    return true;
+}
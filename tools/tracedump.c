@@ -0,0 +1,190 @@
+/**
+ * Decoder for the trace files smallsh writes when $SMALLSH_TRACE is set.
+ *
+ * Prints each event with its time since tracing began, then a summary of
+ * the time spent in each phase:
+ *  parse : from reading a line to having parsed it
+ *  spawn : from starting to create a process to its program being loaded
+ *  run : from the program being loaded to the process being reaped
+ *  builtin : running a built-in within the shell
+ *
+ * Usage: tracedump [-s] tracefile
+ *  -s : print only the summary
+ */
+
+#include "trace.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+enum phase { PARSE, SPAWN, RUN, BUILTIN, PHASES };
+
+// Durations of one phase, in ns.
+struct phase_stats {
+    char *name;
+    long count;
+    uint64_t total;
+    uint64_t max;
+};
+
+// Start of a process's run, remembered until it is reaped.
+struct process_start {
+    int32_t pid;
+    uint64_t time;
+};
+
+void add_time(struct phase_stats *stats, uint64_t start, uint64_t end);
+void print_record(struct trace_record *record);
+
+int main(int argc, char *argv[]) {
+    struct phase_stats stats[PHASES] = {
+        {"parse"}, {"spawn"}, {"run"}, {"builtin"}};
+    struct trace_header header;
+    struct trace_record record;
+    struct process_start *running = NULL;
+    size_t nrunning = 0, capacity = 0;
+    uint64_t parse_start = 0, spawn_start = 0, builtin_start = 0;
+    bool summary_only = false;
+    char *path;
+    FILE *file;
+
+    if (argc == 3 && strcmp(argv[1], "-s") == 0) {
+        summary_only = true;
+        path = argv[2];
+    } else if (argc == 2) {
+        path = argv[1];
+    } else {
+        fprintf(stderr, "usage: tracedump [-s] tracefile\n");
+        exit(EXIT_FAILURE);
+    }
+
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+        fprintf(stderr, "tracedump: %s: not a smallsh trace\n", path);
+        exit(EXIT_FAILURE);
+    }
+    if (header.version != TRACE_VERSION ||
+        header.record_size != sizeof(struct trace_record)) {
+        fprintf(stderr, "tracedump: %s: unsupported trace version %u\n", path,
+                header.version);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!summary_only) {
+        time_t start = header.start_time / 1000000000LL;
+        char when[64];
+
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S",
+                 localtime(&start));
+        printf("smallsh pid %d, traced from %s\n", header.pid, when);
+        printf("%12s %6s %8s  %-13s %s\n", "time us", "line", "pid", "event",
+               "value");
+    }
+
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        if (!summary_only) {
+            print_record(&record);
+        }
+
+        switch (record.event) {
+            case TRACE_PARSE_START:
+                parse_start = record.time;
+                break;
+            case TRACE_PARSE_END:
+                add_time(&stats[PARSE], parse_start, record.time);
+                break;
+            case TRACE_SPAWN:
+                spawn_start = record.time;
+                break;
+            case TRACE_EXEC:
+                // The shell creates one process at a time, so each exec
+                // follows its own spawn.
+                add_time(&stats[SPAWN], spawn_start, record.time);
+                if (nrunning == capacity) {
+                    capacity = capacity == 0 ? 64 : capacity * 2;
+                    running = realloc(running, capacity * sizeof(*running));
+                }
+                running[nrunning].pid = record.pid;
+                running[nrunning++].time = record.time;
+                break;
+            case TRACE_REAP:
+                for (size_t i = 0; i < nrunning; i++) {
+                    if (running[i].pid == record.pid) {
+                        add_time(&stats[RUN], running[i].time, record.time);
+                        running[i] = running[--nrunning];
+                        break;
+                    }
+                }
+                break;
+            case TRACE_BUILTIN_START:
+                builtin_start = record.time;
+                break;
+            case TRACE_BUILTIN_END:
+                add_time(&stats[BUILTIN], builtin_start, record.time);
+                break;
+        }
+    }
+
+    if (!summary_only) {
+        printf("\n");
+    }
+    printf("%-8s %8s %12s %10s %10s\n", "phase", "count", "total ms",
+           "mean us", "max us");
+    for (int i = 0; i < PHASES; i++) {
+        printf("%-8s %8ld %12.3f %10.1f %10.1f\n", stats[i].name,
+               stats[i].count, stats[i].total / 1e6,
+               stats[i].count > 0 ? stats[i].total / 1e3 / stats[i].count : 0,
+               stats[i].max / 1e3);
+    }
+    if (nrunning > 0) {
+        printf("%zu processes were not reaped\n", nrunning);
+    }
+
+    free(running);
+    fclose(file);
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * Counts the time from start to end towards stats.
+ */
+void add_time(struct phase_stats *stats, uint64_t start, uint64_t end) {
+    uint64_t elapsed = end - start;
+
+    stats->count++;
+    stats->total += elapsed;
+    if (elapsed > stats->max) {
+        stats->max = elapsed;
+    }
+}
+
+/**
+ * Prints a record on one line, describing wait statuses.
+ */
+void print_record(struct trace_record *record) {
+    printf("%12.3f %6u %8d  %-13s ", record->time / 1e3, record->line,
+           record->pid, trace_event_name(record->event));
+
+    if (record->event == TRACE_REAP ||
+        (record->event == TRACE_BUILTIN_END && record->value != -1)) {
+        if (WIFSIGNALED(record->value)) {
+            printf("signal %d", WTERMSIG(record->value));
+        } else {
+            printf("exit %d", WEXITSTATUS(record->value));
+        }
+    } else if (record->event == TRACE_PARSE_START ||
+               record->event == TRACE_PARSE_END) {
+        printf("%d", record->value);
+    }
+    printf("\n");
+}
@@ -0,0 +1,135 @@
+/**
+ * Opt-in tracing of the time smallsh spends on each command.
+ *
+ * When $SMALLSH_TRACE names a file, the shell records when it parses each
+ * line, creates and reaps each process and runs each built-in. Records are
+ * fixed-size binary structs kept in a buffer of TRACE_BUFFER_RECORDS, which
+ * is written to the file with a single write() whenever it fills and when
+ * the shell exits. Recording an event is a clock read and a store, so the
+ * trace reflects where time goes without the cost of formatted output.
+ *
+ * tools/tracedump decodes a trace file.
+ */
+
+#include "trace.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// The trace file, or -1 when tracing is off.
+int trace_fd = -1;
+
+// Buffered records, and the number of them.
+struct trace_record trace_buffer[TRACE_BUFFER_RECORDS];
+int trace_count = 0;
+
+// Number of the line being processed.
+uint32_t trace_line = 0;
+
+// CLOCK_MONOTONIC when tracing began, in ns.
+uint64_t trace_start = 0;
+
+// The traced shell, as opposed to children forked from it.
+pid_t trace_pid = 0;
+
+char *event_names[TRACE_EVENTS] = {
+    "parse-start", "parse-end", "spawn",       "exec",
+    "reap",        "builtin-start", "builtin-end",
+};
+
+uint64_t monotonic_ns(void);
+
+/**
+ * Returns the name of event, as tools/tracedump prints it.
+ */
+char *trace_event_name(uint32_t event) {
+    return event < TRACE_EVENTS ? event_names[event] : "unknown";
+}
+
+/**
+ * Records that event happened now. A new line starts with TRACE_PARSE_START.
+ * Call through TRACE(), which checks that tracing is on.
+ */
+void trace_event(enum trace_event event, pid_t pid, int value) {
+    struct trace_record *record;
+
+    if (event == TRACE_PARSE_START) {
+        trace_line++;
+    }
+
+    record = &trace_buffer[trace_count++];
+    record->time = monotonic_ns() - trace_start;
+    record->line = trace_line;
+    record->pid = pid;
+    record->event = event;
+    record->value = value;
+
+    if (trace_count == TRACE_BUFFER_RECORDS) {
+        trace_flush();
+    }
+}
+
+/**
+ * Writes out the buffered records. Forked children that have not yet exec'd
+ * share the buffer, but leave writing it to the shell.
+ */
+void trace_flush(void) {
+    size_t size = trace_count * sizeof(struct trace_record);
+
+    if (trace_fd == -1 || getpid() != trace_pid) {
+        return;
+    }
+
+    if (size > 0 && write(trace_fd, trace_buffer, size) != (ssize_t)size) {
+        perror("smallsh: trace");
+        close(trace_fd);
+        trace_fd = -1;
+    }
+    trace_count = 0;
+}
+
+/**
+ * Starts tracing to the file at path, replacing its contents, if path is
+ * neither NULL nor empty. The variable is removed from the environment so
+ * that a smallsh run by this one does not overwrite the same file.
+ */
+void trace_open(char *path) {
+    struct trace_header header = {TRACE_MAGIC, TRACE_VERSION,
+                                  sizeof(struct trace_record)};
+    struct timespec now;
+
+    if (path == NULL || path[0] == '\0') {
+        return;
+    }
+
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace_fd == -1) {
+        perror(path);
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    header.start_time = now.tv_sec * 1000000000LL + now.tv_nsec;
+    header.pid = trace_pid = getpid();
+    trace_start = monotonic_ns();
+
+    if (write(trace_fd, &header, sizeof(header)) != sizeof(header)) {
+        perror(path);
+        close(trace_fd);
+        trace_fd = -1;
+        return;
+    }
+
+    unsetenv(TRACE_ENV);
+    atexit(trace_flush);
+}
+
+uint64_t monotonic_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
@@ -0,0 +1,71 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Environment variable naming the file smallsh writes its trace to.
+#define TRACE_ENV "SMALLSH_TRACE"
+
+// Identifies trace files; the version changes with the record layout.
+#define TRACE_MAGIC "smshtrc"
+#define TRACE_VERSION 1
+
+// Records held in memory before they are written out together.
+#define TRACE_BUFFER_RECORDS 4096
+
+// Records an event if tracing is on. When it is off, this costs a test and
+// its arguments are not evaluated.
+#define TRACE(event, pid, value)                                               \
+    do {                                                                       \
+        if (trace_fd != -1) {                                                  \
+            trace_event(event, pid, value);                                    \
+        }                                                                      \
+    } while (0)
+
+enum trace_event {
+    TRACE_PARSE_START,   // value is the length of the line
+    TRACE_PARSE_END,     // value is 1 if the line held a command, else 0
+    TRACE_SPAWN,         // about to create the process for a command
+    TRACE_EXEC,          // the process for pid has been created
+    TRACE_REAP,          // pid was waited for; value is its wait status
+    TRACE_BUILTIN_START, // a built-in started running in the shell
+    TRACE_BUILTIN_END,   // value is the built-in's wait status, or -1
+    TRACE_EVENTS
+};
+
+// Start of a trace file, followed by its records.
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    int64_t start_time; // CLOCK_REALTIME when tracing began, in ns
+    int32_t pid;        // of the traced smallsh
+    uint32_t reserved;
+};
+
+/**
+ * An event in the trace.
+ *
+ * time : CLOCK_MONOTONIC nanoseconds since tracing began
+ * line : number of the input line being processed, from 1
+ * pid : the process the event concerns, or 0 for the shell
+ * event : an enum trace_event
+ * value : depends on the event
+ */
+struct trace_record {
+    uint64_t time;
+    uint32_t line;
+    int32_t pid;
+    uint32_t event;
+    int32_t value;
+};
+
+extern int trace_fd;
+
+char *trace_event_name(uint32_t event);
+void trace_event(enum trace_event event, pid_t pid, int value);
+void trace_flush(void);
+void trace_open(char *path);
+
+#endif
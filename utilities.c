@@ -0,0 +1,762 @@
+/**
+ * Small utilities that smallsh runs in-process rather than by creating a
+ * process for the program of the same name: echo, false, printf, pwd, sleep,
+ * test (also as [) and true.
+ *
+ * Each behaves like its coreutils counterpart for the common options, writes
+ * through stdout so that the caller's redirections and flush apply, and
+ * reports diagnostics on stderr as the program would. Like other built-ins,
+ * each returns the wait status the program would have ended with.
+ */
+
+#include "utilities.h"
+#include "events.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Longest conversion specification printf passes on to the C library.
+#define PRINTF_SPEC_LENGTH 64
+
+// Position in the expression being evaluated by test.
+struct test_state {
+    char **argv;
+    int pos;
+    int end;
+    bool error;
+};
+
+uintmax_t integer_arg(char *arg, bool is_signed, int *result);
+bool print_escape(char **p, bool zero_octal);
+bool print_format(char *format, char *argv[], int argc, int *next,
+                  int *result);
+bool test_and(struct test_state *state);
+bool test_binary(struct test_state *state, char *left, char *op, char *right);
+bool test_file(char op, char *path);
+bool test_is_binary(char *arg);
+bool test_is_unary(char *arg);
+long test_number(struct test_state *state, char *arg);
+bool test_not(struct test_state *state);
+bool test_or(struct test_state *state);
+bool test_primary(struct test_state *state);
+
+/**
+ * Prints its arguments separated by spaces and followed by a newline.
+ *
+ * Options, which are words made up of only n, e and E, must come first:
+ *  -n : leave out the trailing newline
+ *  -e : interpret backslash escapes, where \c ends all output
+ *  -E : do not interpret backslash escapes, the default
+ */
+int echo_command(char *argv[], int argc, JobTable jobs) {
+    bool newline = true, escapes = false;
+    int first = 1;
+
+    while (first < argc && argv[first][0] == '-' && argv[first][1] != '\0' &&
+           strspn(argv[first] + 1, "neE") == strlen(argv[first] + 1)) {
+        for (char *opt = argv[first] + 1; *opt != '\0'; opt++) {
+            if (*opt == 'n') {
+                newline = false;
+            } else {
+                escapes = *opt == 'e';
+            }
+        }
+        first++;
+    }
+
+    for (int i = first; i < argc; i++) {
+        if (i > first) {
+            putchar(' ');
+        }
+        if (!escapes) {
+            fputs(argv[i], stdout);
+            continue;
+        }
+        for (char *p = argv[i]; *p != '\0';) {
+            if (*p != '\\') {
+                putchar(*p++);
+            } else if (!print_escape(&p, true)) {
+                return W_EXITCODE(EXIT_SUCCESS, 0);
+            }
+        }
+    }
+
+    if (newline) {
+        putchar('\n');
+    }
+    return W_EXITCODE(EXIT_SUCCESS, 0);
+}
+
+/**
+ * Does nothing, unsuccessfully.
+ */
+int false_command(char *argv[], int argc, JobTable jobs) {
+    return W_EXITCODE(EXIT_FAILURE, 0);
+}
+
+/**
+ * Prints its arguments according to a format, which is reused for as long
+ * as arguments remain.
+ *
+ * Usage: printf format [argument ...]
+ *
+ * The format takes the backslash escapes of C strings, and the conversions
+ * %d %i %o %u %x %X %c %s %e %E %f %F %g %G %a %A of printf(3), with flags,
+ * width and precision, where * takes its value from an argument. %b prints
+ * an argument with its backslash escapes interpreted. Numeric arguments may
+ * be decimal, octal or hexadecimal as in C, or a quote followed by a
+ * character for the value of that character.
+ */
+int printf_command(char *argv[], int argc, JobTable jobs) {
+    int next = 2, first, result = EXIT_SUCCESS;
+
+    if (argc < 2) {
+        fprintf(stderr, "smallsh: printf: usage: printf format [arg ...]\n");
+        return W_EXITCODE(EXIT_FAILURE, 0);
+    }
+
+    do {
+        first = next;
+        if (!print_format(argv[1], argv, argc, &next, &result)) {
+            break;
+        }
+    } while (next < argc && next > first);
+
+    return W_EXITCODE(result, 0);
+}
+
+/**
+ * Prints the working directory.
+ */
+int pwd_command(char *argv[], int argc, JobTable jobs) {
+    char path[PATH_MAX];
+
+    if (getcwd(path, sizeof(path)) == NULL) {
+        perror("smallsh: pwd");
+        return W_EXITCODE(EXIT_FAILURE, 0);
+    }
+
+    puts(path);
+    return W_EXITCODE(EXIT_SUCCESS, 0);
+}
+
+/**
+ * Waits for the sum of the given times, each a number of seconds which may
+ * be fractional and be followed by s, m, h or d for seconds, minutes, hours
+ * or days.
+ *
+ * Ctrl-c ends the wait, and the status is then that of a program killed by
+ * SIGINT, as for the foreground program sleep would have been.
+ */
+int sleep_command(char *argv[], int argc, JobTable jobs) {
+    struct timespec duration;
+    double seconds = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "smallsh: sleep: missing operand\n");
+        return W_EXITCODE(EXIT_FAILURE, 0);
+    }
+
+    for (int i = 1; i < argc; i++) {
+        double value;
+
+        if (parse_duration(argv[i], &value) == -1) {
+            fprintf(stderr, "smallsh: sleep: invalid time interval '%s'\n",
+                    argv[i]);
+            return W_EXITCODE(EXIT_FAILURE, 0);
+        }
+        seconds += value;
+    }
+
+    if (seconds >= LONG_MAX) {
+        duration.tv_sec = LONG_MAX;
+        duration.tv_nsec = 0;
+    } else {
+        duration.tv_sec = seconds;
+        duration.tv_nsec = (seconds - duration.tv_sec) * 1e9;
+    }
+
+    // SIGINT reaches the shell through the event loop's signalfd, so the
+    // wait is for it, for the length of the sleep. It is kept for the shell,
+    // as a program's Ctrl-c would be, so that it also stops a command list.
+    if (wait_signal(SIGINT, &duration)) {
+        keep_signal(SIGINT);
+        return W_EXITCODE(0, SIGINT);
+    }
+    return W_EXITCODE(EXIT_SUCCESS, 0);
+}
+
+/**
+ * Evaluates a conditional expression, ending with status 0 if it is true, 1
+ * if it is false and 2 if it is malformed. Invoked as [, the last argument
+ * must be ].
+ *
+ * Expressions are built from the primaries:
+ *  string, -n string, -z string : whether string is or is not empty
+ *  s1 = s2, s1 == s2, s1 != s2 : string comparisons
+ *  n1 -eq n2, -ne, -lt, -le, -gt, -ge : integer comparisons
+ *  f1 -nt f2, f1 -ot f2, f1 -ef f2 : newer, older and same file
+ *  -b -c -d -e -f -g -h -L -p -r -s -S -u -w -x file : file tests
+ *  -t fd : whether fd is a terminal
+ * combined with ! expr, ( expr ), expr -a expr and expr -o expr, where -a
+ * binds more tightly than -o.
+ *
+ * The string ordering operators < and > are not supported, since smallsh
+ * always reads those words as redirections.
+ */
+int test_command(char *argv[], int argc, JobTable jobs) {
+    struct test_state state = {argv, 1, argc, false};
+    bool result;
+
+    if (strcmp(argv[0], "[") == 0) {
+        if (strcmp(argv[argc - 1], "]") != 0 || argc == 1) {
+            fprintf(stderr, "smallsh: [: missing ']'\n");
+            return W_EXITCODE(2, 0);
+        }
+        state.end--;
+    }
+
+    if (state.end == 1) {
+        return W_EXITCODE(EXIT_FAILURE, 0);
+    }
+
+    result = test_or(&state);
+    if (!state.error && state.pos < state.end) {
+        fprintf(stderr, "smallsh: test: %s: unexpected argument\n",
+                argv[state.pos]);
+        state.error = true;
+    }
+
+    if (state.error) {
+        return W_EXITCODE(2, 0);
+    }
+    return W_EXITCODE(result ? EXIT_SUCCESS : EXIT_FAILURE, 0);
+}
+
+/**
+ * Does nothing, successfully.
+ */
+int true_command(char *argv[], int argc, JobTable jobs) {
+    return W_EXITCODE(EXIT_SUCCESS, 0);
+}
+
+/**
+ * Converts a numeric argument of printf, setting result to failure if it is
+ * not a number. A missing argument is an empty string, which counts as 0.
+ */
+uintmax_t integer_arg(char *arg, bool is_signed, int *result) {
+    uintmax_t value;
+    char *end;
+
+    if (arg[0] == '\0') {
+        return 0;
+    }
+    if (arg[0] == '\'' || arg[0] == '"') {
+        return (unsigned char)arg[1];
+    }
+
+    errno = 0;
+    if (is_signed) {
+        value = strtoimax(arg, &end, 0);
+    } else {
+        value = strtoumax(arg, &end, 0);
+    }
+    if (end == arg || *end != '\0' || errno == ERANGE) {
+        fprintf(stderr, "smallsh: printf: %s: invalid number\n", arg);
+        *result = EXIT_FAILURE;
+    }
+    return value;
+}
+
+/**
+ * Converts text, a number of seconds which may be fractional and be followed
+ * by s, m, h or d for seconds, minutes, hours or days, into seconds.
+ *
+ * Returns 0, or -1 if text is not such a duration or it is infinite or
+ * longer than DURATION_MAX.
+ */
+int parse_duration(char *text, double *seconds) {
+    char *end;
+    double value = strtod(text, &end);
+
+    if (end == text || !(value >= 0) ||
+        (*end != '\0' && (end[1] != '\0' || !strchr("smhd", *end)))) {
+        return -1;
+    }
+
+    switch (*end) {
+        case 'd':
+            value *= 24;
+            // Fall through.
+        case 'h':
+            value *= 60;
+            // Fall through.
+        case 'm':
+            value *= 60;
+            break;
+    }
+
+    if (!isfinite(value) || value > DURATION_MAX) {
+        return -1;
+    }
+
+    *seconds = value;
+    return 0;
+}
+
+/**
+ * Prints the character for the backslash escape at *p and moves *p past it.
+ * Octal escapes have up to three digits, after a 0 if zero_octal is set, as
+ * for echo and %b. Returns false for \c, after which nothing more should be
+ * printed.
+ */
+bool print_escape(char **p, bool zero_octal) {
+    char *s = *p + 1;
+    int value = 0;
+
+    switch (*s) {
+        case 'a':
+            putchar('\a');
+            break;
+        case 'b':
+            putchar('\b');
+            break;
+        case 'c':
+            *p = s + 1;
+            return false;
+        case 'f':
+            putchar('\f');
+            break;
+        case 'n':
+            putchar('\n');
+            break;
+        case 'r':
+            putchar('\r');
+            break;
+        case 't':
+            putchar('\t');
+            break;
+        case 'v':
+            putchar('\v');
+            break;
+        case '\\':
+            putchar('\\');
+            break;
+        case '\0':
+            // A trailing backslash stands for itself.
+            putchar('\\');
+            *p = s;
+            return true;
+        default:
+            if (*s < '0' || *s > '7' || (zero_octal && *s != '0')) {
+                putchar('\\');
+                putchar(*s);
+                break;
+            }
+            if (zero_octal) {
+                s++;
+            }
+            for (int digits = 0; digits < 3 && *s >= '0' && *s <= '7';
+                 digits++) {
+                value = value * 8 + *s++ - '0';
+            }
+            putchar(value);
+            *p = s;
+            return true;
+    }
+
+    *p = s + 1;
+    return true;
+}
+
+/**
+ * Prints format once, taking the arguments for its conversions from argv,
+ * starting at *next. Missing arguments count as empty strings. Returns false
+ * if output should stop, after \c or an invalid conversion.
+ */
+bool print_format(char *format, char *argv[], int argc, int *next,
+                  int *result) {
+    char spec[PRINTF_SPEC_LENGTH];
+    char *p = format;
+
+    while (*p != '\0') {
+        size_t len;
+        char *arg;
+        int value;
+
+        if (*p == '\\') {
+            if (!print_escape(&p, false)) {
+                return false;
+            }
+            continue;
+        }
+        if (*p != '%') {
+            putchar(*p++);
+            continue;
+        }
+        if (p[1] == '%') {
+            putchar('%');
+            p += 2;
+            continue;
+        }
+
+        // Copy the flags, width and precision, filling in each * from the
+        // arguments. A negative precision counts as none, as in printf(3).
+        spec[0] = '%';
+        len = 1;
+        for (p++; *p != '\0' && strchr("-+ #0123456789.*", *p) != NULL; p++) {
+            if (len >= sizeof(spec) - 16) {
+                fprintf(stderr, "smallsh: printf: %s: format too long\n",
+                        format);
+                *result = EXIT_FAILURE;
+                return false;
+            }
+            if (*p != '*') {
+                spec[len++] = *p;
+                continue;
+            }
+            arg = *next < argc ? argv[(*next)++] : "";
+            value = integer_arg(arg, true, result);
+            if (spec[len - 1] == '.' && value < 0) {
+                len--;
+            } else {
+                len += sprintf(spec + len, "%d", value);
+            }
+        }
+
+        arg = *next < argc ? argv[(*next)++] : "";
+        switch (*p) {
+            case 'd':
+            case 'i':
+                spec[len++] = 'j';
+                spec[len++] = *p;
+                spec[len] = '\0';
+                printf(spec, (intmax_t)integer_arg(arg, true, result));
+                break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                spec[len++] = 'j';
+                spec[len++] = *p;
+                spec[len] = '\0';
+                printf(spec, integer_arg(arg, false, result));
+                break;
+            case 'a':
+            case 'A':
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G': {
+                double number = 0;
+                char *end;
+
+                if (arg[0] == '\'' || arg[0] == '"') {
+                    number = (unsigned char)arg[1];
+                } else if (arg[0] != '\0') {
+                    number = strtod(arg, &end);
+                    if (end == arg || *end != '\0') {
+                        fprintf(stderr, "smallsh: printf: %s: invalid number\n",
+                                arg);
+                        *result = EXIT_FAILURE;
+                    }
+                }
+                spec[len++] = *p;
+                spec[len] = '\0';
+                printf(spec, number);
+                break;
+            }
+            case 'c':
+                spec[len++] = 'c';
+                spec[len] = '\0';
+                printf(spec, arg[0]);
+                break;
+            case 's':
+                spec[len++] = 's';
+                spec[len] = '\0';
+                printf(spec, arg);
+                break;
+            case 'b':
+                for (char *b = arg; *b != '\0';) {
+                    if (*b != '\\') {
+                        putchar(*b++);
+                    } else if (!print_escape(&b, true)) {
+                        return false;
+                    }
+                }
+                break;
+            default:
+                fprintf(stderr, "smallsh: printf: %%%c: invalid conversion\n",
+                        *p);
+                *result = EXIT_FAILURE;
+                return false;
+        }
+        p++;
+    }
+
+    return true;
+}
+
+/**
+ * Evaluates the conjunction at the current position of a test expression.
+ */
+bool test_and(struct test_state *state) {
+    bool result = test_not(state);
+
+    while (!state->error && state->pos < state->end &&
+           strcmp(state->argv[state->pos], "-a") == 0) {
+        state->pos++;
+        // Both sides are evaluated, so that errors on either are reported.
+        result = test_not(state) && result;
+    }
+    return result;
+}
+
+/**
+ * Evaluates the binary primary left op right.
+ */
+bool test_binary(struct test_state *state, char *left, char *op, char *right) {
+    struct stat left_sb, right_sb;
+    bool left_ok, right_ok;
+
+    if (op[0] != '-') {
+        bool equal = strcmp(left, right) == 0;
+
+        return op[0] == '!' ? !equal : equal;
+    }
+
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 ||
+        strcmp(op, "-ef") == 0) {
+        left_ok = stat(left, &left_sb) == 0;
+        right_ok = stat(right, &right_sb) == 0;
+
+        if (op[1] == 'e') {
+            return left_ok && right_ok && left_sb.st_dev == right_sb.st_dev &&
+                   left_sb.st_ino == right_sb.st_ino;
+        }
+        if (op[1] == 'o') {
+            // Swap the files, so that both ask whether left is newer.
+            struct stat sb = left_sb;
+            bool ok = left_ok;
+
+            left_sb = right_sb;
+            left_ok = right_ok;
+            right_sb = sb;
+            right_ok = ok;
+        }
+        if (!left_ok || !right_ok) {
+            // A file that exists is newer than one that does not.
+            return left_ok;
+        }
+        return left_sb.st_mtim.tv_sec > right_sb.st_mtim.tv_sec ||
+               (left_sb.st_mtim.tv_sec == right_sb.st_mtim.tv_sec &&
+                left_sb.st_mtim.tv_nsec > right_sb.st_mtim.tv_nsec);
+    }
+
+    long a = test_number(state, left), b = test_number(state, right);
+
+    if (strcmp(op, "-eq") == 0) {
+        return a == b;
+    } else if (strcmp(op, "-ne") == 0) {
+        return a != b;
+    } else if (strcmp(op, "-lt") == 0) {
+        return a < b;
+    } else if (strcmp(op, "-le") == 0) {
+        return a <= b;
+    } else if (strcmp(op, "-gt") == 0) {
+        return a > b;
+    }
+    return a >= b;
+}
+
+/**
+ * Evaluates the unary file primary -op path.
+ */
+bool test_file(char op, char *path) {
+    struct stat sb;
+    int result;
+
+    switch (op) {
+        case 'r':
+            return access(path, R_OK) == 0;
+        case 'w':
+            return access(path, W_OK) == 0;
+        case 'x':
+            return access(path, X_OK) == 0;
+        case 'h':
+        case 'L':
+            result = lstat(path, &sb);
+            break;
+        default:
+            result = stat(path, &sb);
+            break;
+    }
+    if (result != 0) {
+        return false;
+    }
+
+    switch (op) {
+        case 'b':
+            return S_ISBLK(sb.st_mode);
+        case 'c':
+            return S_ISCHR(sb.st_mode);
+        case 'd':
+            return S_ISDIR(sb.st_mode);
+        case 'f':
+            return S_ISREG(sb.st_mode);
+        case 'g':
+            return (sb.st_mode & S_ISGID) != 0;
+        case 'h':
+        case 'L':
+            return S_ISLNK(sb.st_mode);
+        case 'p':
+            return S_ISFIFO(sb.st_mode);
+        case 's':
+            return sb.st_size > 0;
+        case 'S':
+            return S_ISSOCK(sb.st_mode);
+        case 'u':
+            return (sb.st_mode & S_ISUID) != 0;
+        default:
+            return true;
+    }
+}
+
+/**
+ * Whether arg is one of the binary operators of test.
+ */
+bool test_is_binary(char *arg) {
+    static char *operators[] = {"=",   "==",  "!=",  "-eq", "-ne",
+                                "-lt", "-le", "-gt", "-ge", "-nt",
+                                "-ot", "-ef"};
+
+    for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+        if (strcmp(arg, operators[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Whether arg is one of the unary operators of test.
+ */
+bool test_is_unary(char *arg) {
+    return arg[0] == '-' && arg[1] != '\0' && arg[2] == '\0' &&
+           strchr("bcdefghLnprsStuwxz", arg[1]) != NULL;
+}
+
+/**
+ * Converts an integer operand of test, which may be surrounded by blanks.
+ */
+long test_number(struct test_state *state, char *arg) {
+    char *end;
+    long value;
+
+    errno = 0;
+    value = strtol(arg, &end, 10);
+    while (*end == ' ' || *end == '\t') {
+        end++;
+    }
+    if (end == arg || *end != '\0' || errno == ERANGE) {
+        fprintf(stderr, "smallsh: test: %s: integer expected\n", arg);
+        state->error = true;
+    }
+    return value;
+}
+
+/**
+ * Evaluates the possibly negated primary at the current position of a test
+ * expression. As POSIX requires, ! followed by a binary operator is a string
+ * operand rather than a negation.
+ */
+bool test_not(struct test_state *state) {
+    char **argv = state->argv;
+    int pos = state->pos;
+
+    if (pos < state->end && strcmp(argv[pos], "!") == 0 &&
+        !(pos + 2 < state->end && test_is_binary(argv[pos + 1]))) {
+        state->pos++;
+        return !test_not(state);
+    }
+    return test_primary(state);
+}
+
+/**
+ * Evaluates the disjunction at the current position of a test expression.
+ */
+bool test_or(struct test_state *state) {
+    bool result = test_and(state);
+
+    while (!state->error && state->pos < state->end &&
+           strcmp(state->argv[state->pos], "-o") == 0) {
+        state->pos++;
+        result = test_and(state) || result;
+    }
+    return result;
+}
+
+/**
+ * Evaluates the primary at the current position of a test expression. An
+ * operator without the operands it needs is taken as a string.
+ */
+bool test_primary(struct test_state *state) {
+    char **argv = state->argv;
+    int pos = state->pos;
+    bool result;
+
+    if (pos >= state->end) {
+        fprintf(stderr, "smallsh: test: argument expected\n");
+        state->error = true;
+        return false;
+    }
+
+    if (pos + 2 < state->end && test_is_binary(argv[pos + 1])) {
+        state->pos += 3;
+        return test_binary(state, argv[pos], argv[pos + 1], argv[pos + 2]);
+    }
+
+    if (strcmp(argv[pos], "(") == 0 && pos + 1 < state->end) {
+        state->pos++;
+        result = test_or(state);
+        if (!state->error && (state->pos >= state->end ||
+                              strcmp(argv[state->pos], ")") != 0)) {
+            fprintf(stderr, "smallsh: test: ')' expected\n");
+            state->error = true;
+        }
+        state->pos++;
+        return result;
+    }
+
+    if (test_is_unary(argv[pos]) && pos + 1 < state->end) {
+        char op = argv[pos][1];
+        char *operand = argv[pos + 1];
+
+        state->pos += 2;
+        switch (op) {
+            case 'n':
+                return operand[0] != '\0';
+            case 'z':
+                return operand[0] == '\0';
+            case 't':
+                return isatty(test_number(state, operand));
+            default:
+                return test_file(op, operand);
+        }
+    }
+
+    state->pos++;
+    return argv[pos][0] != '\0';
+}
@@ -0,0 +1,19 @@
+#ifndef UTILITIES_H
+#define UTILITIES_H
+
+#include "processes.h"
+
+// Longest duration parse_duration() accepts, about 31 years, which leaves a
+// deadline that far off representable as a time_t.
+#define DURATION_MAX 1e9
+
+int echo_command(char *argv[], int argc, JobTable jobs);
+int false_command(char *argv[], int argc, JobTable jobs);
+int parse_duration(char *text, double *seconds);
+int printf_command(char *argv[], int argc, JobTable jobs);
+int pwd_command(char *argv[], int argc, JobTable jobs);
+int sleep_command(char *argv[], int argc, JobTable jobs);
+int test_command(char *argv[], int argc, JobTable jobs);
+int true_command(char *argv[], int argc, JobTable jobs);
+
+#endif
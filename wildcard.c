@@ -0,0 +1,358 @@
+/**
+ * Expansion of patterns, words holding *, ? or [...], into the sorted names
+ * of the files they match, as sh does. A pattern that matches nothing is left
+ * as it is. The tokenizer marks the words that may be patterns, and they are
+ * expanded as their command runs, so each run sees the files there are then.
+ *
+ * Each / separated component of a pattern that has a wildcard is matched
+ * with fnmatch() against the listing of its directory, where a leading dot
+ * must be matched by a leading dot. There is no quoting, so a backslash is
+ * an ordinary character.
+ *
+ * Listings are read with getdents64() into a large buffer, sorted once, and
+ * kept for the WILDCARD_CACHE_SIZE most recently used directories. A listing
+ * is keyed by the directory's device and inode and used again while its
+ * modification time is unchanged, so a script expanding patterns over a large
+ * directory reads and sorts it once. A directory modified within a second of
+ * being read could change again without its time moving, so such a listing
+ * is not trusted and the directory is read again at its next use.
+ *
+ * The literal start of a component, before its first wildcard, is found in
+ * the sorted listing by binary search, so only the names that share it are
+ * given to fnmatch().
+ */
+
+#define _GNU_SOURCE
+#include "wildcard.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// A record read by getdents64().
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// The cached listings, and the number of lookups made so far, by which the
+// least recently used listing is found.
+struct dir_listing listings[WILDCARD_CACHE_SIZE];
+unsigned long lookups = 0;
+
+// The buffer getdents64() reads into, allocated on first use.
+char *dirent_buffer = NULL;
+
+void add_match(Arena arena, Command cmd, char *path, size_t length);
+int compare_names(const void *a, const void *b);
+bool has_wildcards(char *text, size_t length);
+struct dir_listing *list_directory(char *path);
+void match_path(Arena arena, Command cmd, char *path, size_t length,
+                char *rest, int *matches);
+bool read_listing(int fd, struct dir_listing *listing);
+
+/**
+ * Adds the first length bytes of path to the arguments of cmd, copied into
+ * arena.
+ */
+void add_match(Arena arena, Command cmd, char *path, size_t length) {
+    char *match = arena_alloc(arena, length + 1);
+
+    memcpy(match, path, length);
+    match[length] = '\0';
+    add_arg(arena, cmd, match);
+}
+
+/**
+ * Orders two struct dir_entry by name, for qsort().
+ */
+int compare_names(const void *a, const void *b) {
+    return strcmp(((const struct dir_entry *)a)->name,
+                  ((const struct dir_entry *)b)->name);
+}
+
+/**
+ * Adds the names of the files matching pattern to the arguments of cmd,
+ * sorted, with the names allocated from arena.
+ *
+ * Returns the number of names added, 0 if pattern matches nothing or has no
+ * wildcards after all, such as a [ without a closing ].
+ */
+int expand_pattern(Arena arena, char *pattern, Command cmd) {
+    char path[PATH_MAX];
+    int matches = 0;
+
+    if (!has_wildcards(pattern, strlen(pattern)) ||
+        strlen(pattern) >= sizeof(path)) {
+        return 0;
+    }
+
+    match_path(arena, cmd, path, 0, pattern, &matches);
+    return matches;
+}
+
+/**
+ * Returns whether the length bytes of text hold a wildcard: *, ?, or [
+ * followed later by ].
+ */
+bool has_wildcards(char *text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '*' || text[i] == '?' ||
+            (text[i] == '[' && memchr(text + i + 1, ']', length - i - 1))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Returns the listing of the directory at path, from the cache if it is
+ * unchanged, else read into the cache in place of the least recently used.
+ *
+ * Returns NULL if path is not a directory that can be read, or every
+ * listing is in use.
+ */
+struct dir_listing *list_directory(char *path) {
+    struct dir_listing *listing = NULL, *slot = NULL;
+    struct timespec now;
+    struct stat st;
+    int fd;
+
+    if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode)) {
+        return NULL;
+    }
+    lookups++;
+
+    for (int i = 0; i < WILDCARD_CACHE_SIZE && listing == NULL; i++) {
+        struct dir_listing *cached = &listings[i];
+
+        if (cached->entries != NULL && cached->dev == st.st_dev &&
+            cached->ino == st.st_ino) {
+            listing = cached;
+        } else if (cached->busy == 0 &&
+                   (slot == NULL ||
+                    (slot->entries != NULL &&
+                     (cached->entries == NULL ||
+                      cached->last_used < slot->last_used)))) {
+            // An empty slot, else the least recently used.
+            slot = cached;
+        }
+    }
+
+    // A listing being matched against is not replaced under its matcher,
+    // even if the directory has since changed.
+    if (listing != NULL &&
+        (listing->busy > 0 ||
+         (listing->trusted && listing->mtime.tv_sec == st.st_mtim.tv_sec &&
+          listing->mtime.tv_nsec == st.st_mtim.tv_nsec))) {
+        listing->last_used = lookups;
+        return listing;
+    }
+    if (listing != NULL) {
+        slot = listing;
+    }
+    if (slot == NULL) {
+        return NULL;
+    }
+
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    free(slot->entries);
+    free(slot->names);
+    slot->entries = NULL;
+    slot->names = NULL;
+    if (!read_listing(fd, slot)) {
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    qsort(slot->entries, slot->count, sizeof(struct dir_entry),
+          compare_names);
+    slot->dev = st.st_dev;
+    slot->ino = st.st_ino;
+    slot->mtime = st.st_mtim;
+    slot->trusted = now.tv_sec - st.st_mtim.tv_sec > 1;
+    slot->last_used = lookups;
+
+    return slot;
+}
+
+/**
+ * Matches rest, what is left of a pattern, within the directory path, of
+ * which the first length bytes are filled in and end with a slash unless
+ * length is 0 for the working directory. Adds each file that matches the
+ * whole pattern to cmd, counting them in matches.
+ */
+void match_path(Arena arena, Command cmd, char *path, size_t length,
+                char *rest, int *matches) {
+    struct dir_listing *listing;
+    char component[NAME_MAX + 1];
+    size_t part, fixed, low, high;
+    bool last;
+    struct stat st;
+
+    // Components without wildcards are taken as they are.
+    while (true) {
+        part = strcspn(rest, "/");
+        last = rest[part] == '\0';
+        if (has_wildcards(rest, part)) {
+            break;
+        }
+        if (length + part + 1 >= PATH_MAX) {
+            return;
+        }
+
+        memcpy(path + length, rest, part + !last);
+        length += part + !last;
+        if (last) {
+            // The whole pattern has matched if the file exists.
+            path[length] = '\0';
+            if (lstat(path, &st) == 0) {
+                add_match(arena, cmd, path, length);
+                (*matches)++;
+            }
+            return;
+        }
+        rest += part + 1;
+    }
+
+    if (part > NAME_MAX) {
+        return;
+    }
+    memcpy(component, rest, part);
+    component[part] = '\0';
+
+    path[length] = '\0';
+    listing = list_directory(length == 0 ? "." : path);
+    if (listing == NULL) {
+        return;
+    }
+    listing->busy++;
+
+    // Find the first name sharing the component's literal start.
+    fixed = strcspn(component, "*?[");
+    low = 0;
+    high = listing->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+
+        if (strncmp(listing->entries[middle].name, component, fixed) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    for (size_t i = low; i < listing->count &&
+                         strncmp(listing->entries[i].name, component,
+                                 fixed) == 0;
+         i++) {
+        struct dir_entry *entry = &listing->entries[i];
+        size_t name_length = strlen(entry->name);
+
+        if (fnmatch(component, entry->name, FNM_PERIOD | FNM_NOESCAPE) != 0 ||
+            length + name_length + 1 >= PATH_MAX) {
+            continue;
+        }
+        memcpy(path + length, entry->name, name_length);
+
+        if (last) {
+            add_match(arena, cmd, path, length + name_length);
+            (*matches)++;
+            continue;
+        }
+
+        // Only a directory can hold the rest of the pattern.
+        path[length + name_length] = '\0';
+        if (entry->type != DT_DIR &&
+            ((entry->type != DT_LNK && entry->type != DT_UNKNOWN) ||
+             stat(path, &st) == -1 || !S_ISDIR(st.st_mode))) {
+            continue;
+        }
+        path[length + name_length] = '/';
+        match_path(arena, cmd, path, length + name_length + 1,
+                   rest + part + 1, matches);
+    }
+
+    listing->busy--;
+}
+
+/**
+ * Reads the names in the directory open as fd into listing, unsorted, with
+ * getdents64(). Returns false, with nothing allocated, if it cannot be read.
+ */
+bool read_listing(int fd, struct dir_listing *listing) {
+    size_t size = 0, capacity = 4096, count = 0, slots = 64;
+    char *names = malloc(capacity);
+    struct dir_entry *entries = malloc(slots * sizeof(struct dir_entry));
+    size_t *offsets = malloc(slots * sizeof(size_t));
+    long got;
+
+    if (dirent_buffer == NULL) {
+        dirent_buffer = malloc(WILDCARD_BUFFER_SIZE);
+    }
+
+    while ((got = syscall(SYS_getdents64, fd, dirent_buffer,
+                          WILDCARD_BUFFER_SIZE)) > 0) {
+        for (long pos = 0; pos < got;) {
+            struct linux_dirent64 *dirent =
+                (struct linux_dirent64 *)(dirent_buffer + pos);
+            size_t name_size = strlen(dirent->d_name) + 1;
+
+            pos += dirent->d_reclen;
+            if (strcmp(dirent->d_name, ".") == 0 ||
+                strcmp(dirent->d_name, "..") == 0) {
+                continue;
+            }
+
+            while (size + name_size > capacity) {
+                capacity *= 2;
+                names = realloc(names, capacity);
+            }
+            if (count == slots) {
+                slots *= 2;
+                entries = realloc(entries, slots * sizeof(struct dir_entry));
+                offsets = realloc(offsets, slots * sizeof(size_t));
+            }
+
+            memcpy(names + size, dirent->d_name, name_size);
+            entries[count].type = dirent->d_type;
+            offsets[count++] = size;
+            size += name_size;
+        }
+    }
+
+    if (got == -1) {
+        free(names);
+        free(entries);
+        free(offsets);
+        return false;
+    }
+
+    // The names have stopped moving, so they can be pointed to.
+    for (size_t i = 0; i < count; i++) {
+        entries[i].name = names + offsets[i];
+    }
+    free(offsets);
+
+    listing->names = names;
+    listing->entries = entries;
+    listing->count = count;
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef WILDCARD_H
+#define WILDCARD_H
+
+#include "arena.h"
+#include "commands.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+// Directories whose listings are kept for patterns to match against.
+#define WILDCARD_CACHE_SIZE 64
+
+// Bytes read from a directory by each getdents64() call.
+#define WILDCARD_BUFFER_SIZE (1024 * 1024)
+
+/**
+ * A name in a directory listing.
+ *
+ * Fields:
+ * name : the name
+ * type : its d_type, DT_UNKNOWN if the file system does not say
+ */
+struct dir_entry {
+    char *name;
+    unsigned char type;
+};
+
+/**
+ * The sorted listing of a directory, kept while the directory is unchanged.
+ *
+ * Fields:
+ * dev, ino : the directory
+ * mtime : its modification time when it was read
+ * trusted : whether mtime was far enough in the past when the directory was
+ *      read that a change since would have moved it
+ * entries : the names in the directory, sorted, without . and ..
+ * count : number of entries
+ * names : the storage of the names
+ * last_used : when the listing was last used, counted in lookups
+ * busy : number of matches going through entries, while which the listing
+ *      is neither replaced nor read again
+ */
+struct dir_listing {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    bool trusted;
+    struct dir_entry *entries;
+    size_t count;
+    char *names;
+    unsigned long last_used;
+    int busy;
+};
+
+int expand_pattern(Arena arena, char *pattern, Command cmd);
+
+#endif